@@ -1,13 +1,23 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <string_view>
+#include <memory>
 #include <vector>
 #include <algorithm>
+#include <map>
+#include <set>
+#include <tuple>
 #include <unordered_set>
 #include <unordered_map>
+#include <deque>
 #include <cstring>
+#include <cstdint>
 #include <cstdarg>
 #include <cassert>
+#include <thread>
+#include <atomic>
+#include <chrono>
 using namespace std;
 
 //--------------------------------------------------------//
@@ -20,9 +30,21 @@ using namespace std;
 #define COLOR_BLUE   "\x1B[34m"
 
 static int verbose = 0;
-static void (*on_err)() = nullptr;
+static bool opt_fuse = true; // generate superinstructions, disabled by '-fno-fuse'
+static bool opt_peephole = true; // thread jumps & remove dead code, disabled by '-fno-peephole'
+static bool opt_inline = true; // inline small functions at their call sites, disabled by '-fno-inline'
+static int opt_level = 1; // '-O0': code as generated, '-O1': peephole, '-O2': also over basic blocks
+static bool opt_reg = false; // run on the register backend, enabled by '-r'
+static bool opt_tos = false; // cache stack top in the vm, enabled by '-t'
+static bool opt_jit = true; // compile hot functions to machine code, disabled by '-fno-jit'
+static bool opt_cache = true; // reuse compiled scripts from the cache, disabled by '-fno-cache'
+static bool opt_profile_ops = false; // profile instructions, enabled by '--profile-ops[=file.csv]'
+static bool opt_profile_lines = false; // profile source lines, enabled by '--line-profile'
+static const char* profile_file = nullptr;
+static thread_local void (*on_err)() = nullptr;
+static thread_local FILE* log_file = stderr; // per job in batch mode
 
-template <int level = 0> inline int log(const char* fmt, va_list ap) { return (verbose < level) ? 0 : vfprintf(stderr, fmt, ap); }
+template <int level = 0> inline int log(const char* fmt, va_list ap) { return (verbose < level || !log_file) ? 0 : vfprintf(log_file, fmt, ap); }
 template <int level = 0> inline int log(const char* fmt, ...) { va_list ap; va_start(ap, fmt); return log<level>(fmt, ap); }
 
 inline void err(const char* fmt, ...) { va_list ap; va_start(ap, fmt); log(COLOR_RED "Error: "); log(fmt, ap); log(COLOR_NORMAL); if (on_err) on_err(); }
@@ -39,17 +61,36 @@ enum instruction {
 	SHL,   SHR,   AND,  OR,  NOT,
 	EQ,    NE,    GE,   GT,  LE,   LT,   LAND, LOR,  LNOT,
 	ENTER, LEAVE, CALL, RET, JMP,  JZ,   JNZ,
+	CALLX, TAILCALL,
+	LGETPUSH, PUSHI, ADDI, SUBI, MULI, // superinstructions, generated by fuse()
+	EQI,   NEI,   GEI,  GTI, LEI,  LTI,
+	WGET,  WPUT,  WLGET, WLPUT,            // 'long long' and 'double', two words each
+	LADD,  LSUB,  LMUL, LDIV, LMOD,
+	LEQ,   LNE,   LGE,  LGT, LLE,  LLT,
+	DADD,  DSUB,  DMUL, DDIV,
+	DEQ,   DNE,   DGE,  DGT, DLE,  DLT,
+	I2L,   I2D,   L2D,  D2L, L2I,  D2I,
 	INVALID,
 };
 
-const char* instruction_name =
-	"EXIT  PUSH  POP   ADJ   "
-	"MOV   LEA   GET   PUT   LLEA  LGET  LPUT  "
-	"SGET  SPUT  "
-	"ADD   SUB   MUL   DIV   MOD   NEG   INC   DEC   "
-	"SHL   SHR   AND   OR    NOT   "
-	"EQ    NE    GE    GT    LE    LT    LAND  LOR   LNOT  "
-	"ENTER LEAVE CALL  RET   JMP   JZ    JNZ   ";
+const char* instruction_name[] = {
+	"EXIT",  "PUSH",  "POP",  "ADJ",
+	"MOV",   "LEA",   "GET",  "PUT", "LLEA", "LGET", "LPUT",
+	"SGET",  "SPUT",
+	"ADD",   "SUB",   "MUL",  "DIV", "MOD",  "NEG",  "INC",  "DEC",
+	"SHL",   "SHR",   "AND",  "OR",  "NOT",
+	"EQ",    "NE",    "GE",   "GT",  "LE",   "LT",   "LAND", "LOR",  "LNOT",
+	"ENTER", "LEAVE", "CALL", "RET", "JMP",  "JZ",   "JNZ",
+	"CALLX", "TAILCALL",
+	"LGETPUSH", "PUSHI", "ADDI", "SUBI", "MULI",
+	"EQI",   "NEI",   "GEI",  "GTI", "LEI",  "LTI",
+	"WGET",  "WPUT",  "WLGET", "WLPUT",
+	"LADD",  "LSUB",  "LMUL", "LDIV", "LMOD",
+	"LEQ",   "LNE",   "LGE",  "LGT", "LLE",  "LLT",
+	"DADD",  "DSUB",  "DMUL", "DDIV",
+	"DEQ",   "DNE",   "DGE",  "DGT", "DLE",  "DLT",
+	"I2L",   "I2D",   "L2D",  "D2L", "L2I",  "D2I",
+};
 
 inline bool instruction_has_parameter(int code)
 {
@@ -57,9 +98,49 @@ inline bool instruction_has_parameter(int code)
 			code == LEA || code == GET || code == PUT ||
 			code == LLEA || code == LGET || code == LPUT ||
 			code == ENTER || code == CALL || code == RET ||
-			code == JMP || code == JZ || code == JNZ);
+			code == JMP || code == JZ || code == JNZ ||
+			code == CALLX || code == TAILCALL || (code >= LGETPUSH && code <= LTI) ||
+			(code >= WGET && code <= WLPUT) || (code >= I2L && code <= D2L));
+}
+
+inline bool instruction_is_jump(int code)
+{
+	return (code == CALL || code == JMP || code == JZ || code == JNZ);
+}
+
+inline bool instruction_is_wide(int code) // works on 'long long' or 'double' values, see run_wide()
+{
+	return (code >= WGET && code <= D2I);
+}
+
+inline bool is_wide_type(const string& type_name)
+{
+	return (type_name == "long long" || type_name == "double");
 }
 
+// a wide value takes two words, the lower one first
+template <typename T> inline T wide_get(const int* p) { T v; memcpy(&v, p, sizeof(v)); return v; }
+template <typename T> inline void wide_put(int* p, T v) { memcpy(p, &v, sizeof(v)); }
+
+//--------------------------------------------------------//
+// dispatch engine
+//
+// the VM loop in run() is threaded code: the loaded image is pre-decoded into
+// handler addresses and dispatched by computed goto. build with
+// `-DICPP_SWITCH_DISPATCH` (or with a compiler without labels-as-values) to
+// fall back to a dense jump table generated from `switch`.
+
+#if defined(__GNUC__) && !defined(ICPP_SWITCH_DISPATCH)
+#define ICPP_COMPUTED_GOTO
+#endif
+
+// on x86-64 linux, run() also compiles hot functions to machine code (see
+// "jit compiler" below). build with `-DICPP_NO_JIT` to leave it out.
+
+#if defined(ICPP_COMPUTED_GOTO) && defined(__x86_64__) && defined(__linux__) && !defined(ICPP_NO_JIT)
+#define ICPP_JIT
+#endif
+
 //--------------------------------------------------------//
 // operator precedence in c/c++
 // ref: https://en.cppreference.com/w/cpp/language/operator_precedence
@@ -108,51 +189,540 @@ unordered_map<string, int> operator_precedence = {
 };
 
 //--------------------------------------------------------//
-// global variables
+// lexer
+//
+// next() classifies characters by a table, matches keywords and operators by
+// walking a DFA built from the token list below, and skips blanks, comments
+// and string bodies 16 bytes at a time with SSE2 (32 with AVX2, when built
+// with '-mavx2').
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+enum char_class : unsigned char {
+	CC_BLANK  = 1, // ' ', '\t'
+	CC_SYMBOL = 2, // starts or continues a symbol
+	CC_DIGIT  = 4, // starts a number
+	CC_NUMBER = 8, // continues a number
+};
+
+struct char_class_table {
+	unsigned char c[256] = {};
+	constexpr char_class_table()
+	{
+		c[static_cast<unsigned char>(' ')] = c[static_cast<unsigned char>('\t')] = CC_BLANK;
+		c[static_cast<unsigned char>('_')] = CC_SYMBOL;
+		for (int i = 'a'; i <= 'z'; ++i) c[i] = CC_SYMBOL | CC_NUMBER;
+		for (int i = 'A'; i <= 'Z'; ++i) c[i] = CC_NUMBER;
+		for (int i = '0'; i <= '9'; ++i) c[i] = CC_DIGIT | CC_NUMBER;
+		c[static_cast<unsigned char>('.')] = CC_NUMBER;
+	}
+	unsigned char operator[](char ch) const { return c[static_cast<unsigned char>(ch)]; }
+};
+
+constexpr char_class_table char_classes;
+
+// keywords and operators are interned: the lexer gives each of them its token_kind, which the
+// parser compares instead of the text
+enum token_kind {
+	T_NONE, // other symbols, numbers, strings, and the end of source
+	T_AUTO, T_CLASS, T_CONST, T_DO, T_ELSE, T_ENUM, T_EXTERN, T_FOR, T_IF, T_NAMESPACE,
+	T_RETURN, T_SIZEOF, T_STATIC, T_STRUCT, T_TEMPLATE, T_TYPEDEF, T_UNION, T_USING, T_WHILE,
+	T_CHAR, T_SHORT, T_INT, T_LONG, T_LONGLONG, T_FLOAT, T_DOUBLE, T_SIGNED, T_UNSIGNED, T_SIZE_T, // built-in types
+	T_EQ, T_ASSIGN, T_NE, T_NOT, T_INC, T_ADD_ASSIGN, T_ADD, T_DEC, T_SUB_ASSIGN, T_ARROW_STAR, T_ARROW, T_SUB, // operators
+	T_COMPARE, T_LE, T_SHL_ASSIGN, T_SHL, T_LT, T_GE, T_SHR_ASSIGN, T_SHR, T_GT,
+	T_LOR, T_OR_ASSIGN, T_OR, T_LAND, T_AND_ASSIGN, T_AND, T_SCOPE, T_COLON, T_XOR,
+	T_MUL_ASSIGN, T_MUL, T_DIV_ASSIGN, T_DIV, T_MOD_ASSIGN, T_MOD, T_QUESTION, T_TILDE_ASSIGN, T_TILDE,
+	T_SEMICOLON, T_DOT_STAR, T_DOT, T_LBRACE, T_RBRACE, T_LBRACKET, T_RBRACKET, T_LPAREN, T_RPAREN, T_COMMA,
+	T_COUNT,
+};
+
+const char* const token_kind_text[] = {
+	"",
+	"auto", "class", "const", "do", "else", "enum", "extern", "for", "if", "namespace",
+	"return", "sizeof", "static", "struct", "template", "typedef", "union", "using", "while",
+	"char", "short", "int", "long", "longlong", "float", "double", "signed", "unsigned", "size_t",
+	"==", "=", "!=", "!", "++", "+=", "+", "--", "-=", "->*", "->", "-",
+	"<=>", "<=", "<<=", "<<", "<", ">=", ">>=", ">>", ">",
+	"||", "|=", "|", "&&", "&=", "&", "::", ":", "^",
+	"*=", "*", "/=", "/", "%=", "%", "?", "~=", "~",
+	";", ".*", ".", "{", "}", "[", "]", "(", ")", ",",
+};
+
+static_assert(sizeof(token_kind_text) / sizeof(token_kind_text[0]) == T_COUNT, "token table mismatch");
+
+struct token_trie { // of token_kind_text, walked for the longest operator, or a whole keyword
+	struct state { short next[128]; token_kind kind; };
+	vector<state> states;
+
+	token_trie()
+	{
+		states.push_back(state());
+		for (int k = T_NONE + 1; k < T_COUNT; ++k) {
+			size_t s = 0;
+			for (const char* c = token_kind_text[k]; *c; ++c) {
+				if (!states[s].next[static_cast<int>(*c)]) {
+					states[s].next[static_cast<int>(*c)] = static_cast<short>(states.size());
+					states.push_back(state());
+				}
+				s = states[s].next[static_cast<int>(*c)];
+			}
+			states[s].kind = static_cast<token_kind>(k);
+		}
+	}
+
+	token_kind match_operator(const char*& p) const // the longest operator at p, moved over it
+	{
+		token_kind kind = T_NONE;
+		const char* end = p;
+		for (size_t s = 0; static_cast<unsigned char>(*end) < 128 && states[s].next[static_cast<int>(*end)]; ) {
+			s = states[s].next[static_cast<int>(*end++)];
+			if (states[s].kind >= T_EQ) { kind = states[s].kind; p = end; }
+		}
+		return kind;
+	}
+
+	token_kind match_keyword(const char* p, const char* end) const // if the symbol in [p, end) is a keyword
+	{
+		size_t s = 0;
+		for (; p != end; ++p) {
+			if (!(s = states[s].next[static_cast<int>(*p)])) return T_NONE;
+		}
+		return (states[s].kind < T_EQ ? states[s].kind : T_NONE);
+	}
+};
+
+const token_trie tokens;
+
+struct precedence_table { // operator_precedence by token_kind, 0 for none
+	int p[T_COUNT] = {};
+	precedence_table()
+	{
+		for (int k = 0; k < T_COUNT; ++k) {
+			auto it = operator_precedence.find(token_kind_text[k]);
+			if (it != operator_precedence.end()) p[k] = it->second;
+		}
+	}
+};
+
+const precedence_table token_precedence;
+
+// the first character in [p, end) which is (if 'found' is true) or is not one of a and b, or end
+template <bool found>
+inline const char* scan_bytes(const char* p, const char* end, char a, char b)
+{
+#if defined(__AVX2__)
+	const __m256i a32 = _mm256_set1_epi8(a), b32 = _mm256_set1_epi8(b);
+	for (; end - p >= 32; p += 32) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+		unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, a32), _mm256_cmpeq_epi8(v, b32)));
+		if (!found) mask = ~mask;
+		if (mask) return p + __builtin_ctz(mask);
+	}
+#endif
+#if defined(__SSE2__)
+	const __m128i a16 = _mm_set1_epi8(a), b16 = _mm_set1_epi8(b);
+	for (; end - p >= 16; p += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, a16), _mm_cmpeq_epi8(v, b16)));
+		if (!found) mask = ~mask & 0xFFFF;
+		if (mask) return p + __builtin_ctz(mask);
+	}
+#endif
+	while (p < end && (*p == a || *p == b) != found) ++p;
+	return p;
+}
+
+inline const char* find_bytes(const char* p, const char* end, char a, char b) { return scan_bytes<true>(p, end, a, b); }
+inline const char* skip_bytes(const char* p, const char* end, char a, char b) { return scan_bytes<false>(p, end, a, b); }
+
+//--------------------------------------------------------//
+// vm memory
+//
+// one anonymous mapping per vm, only reserved up front, so the kernel commits
+// (and zeroes) pages on first touch. data & code are loaded from the bottom
+// and the stack grows down from the top, with an inaccessible guard area
+// below the stack and another above the top, so that running out of stack
+// faults there instead of silently overwriting data.
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <csignal>
+#include <csetjmp>
+#include <exception>
+
+static size_t opt_mem_size = 64 << 20; // bytes for data, code & stack, set by '--mem='
+static size_t opt_stack_size = 16 << 20; // bytes of them for the stack, set by '--stack='
+
+const size_t MEM_GUARD_SIZE = 1 << 20; // bytes of each guard area
+
+struct vm_memory {
+	char* map = nullptr; // [ data & code ][ guard ][ stack ][ guard ]
+	size_t data_bytes = 0, stack_bytes = 0;
+
+	vm_memory() = default;
+	vm_memory(const vm_memory&) = delete;
+	vm_memory(vm_memory&& o) noexcept { swap(o); }
+	vm_memory& operator=(vm_memory&& o) noexcept { swap(o); return *this; }
+	~vm_memory() { release(); }
+
+	void swap(vm_memory& o)
+	{
+		std::swap(map, o.map);
+		std::swap(data_bytes, o.data_bytes);
+		std::swap(stack_bytes, o.stack_bytes);
+	}
+
+	bool allocate(size_t mem_size, size_t stack_size)
+	{
+		release();
+		size_t page = sysconf(_SC_PAGESIZE);
+		stack_size = (stack_size + page - 1) / page * page;
+		if (mem_size <= stack_size || stack_size == 0) return false;
+		size_t data_size = (mem_size - stack_size + page - 1) / page * page;
+		if ((data_size + MEM_GUARD_SIZE + stack_size) / sizeof(int) > INT_MAX) return false; // addressed by int
 
-const int MEM_SIZE = 1024 * 1024; // 1 MB * sizeof(size_t)
-vector<int> m(MEM_SIZE);
+		size_t total = data_size + stack_size + MEM_GUARD_SIZE * 2;
+		void* p = mmap(nullptr, total, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (p == MAP_FAILED) return false;
+		map = static_cast<char*>(p);
+		data_bytes = data_size;
+		stack_bytes = stack_size;
+		if (mprotect(map, data_bytes, PROT_READ | PROT_WRITE) != 0 ||
+				mprotect(map + data_bytes + MEM_GUARD_SIZE, stack_bytes, PROT_READ | PROT_WRITE) != 0) {
+			release();
+			return false;
+		}
+		return true;
+	}
+
+	void release()
+	{
+		if (map) munmap(map, data_bytes + stack_bytes + MEM_GUARD_SIZE * 2);
+		map = nullptr;
+		data_bytes = stack_bytes = 0;
+	}
+
+	bool map_image(int fd, size_t offset, size_t words) // map a file over the data & code area, copied on write
+	{
+		size_t page = sysconf(_SC_PAGESIZE);
+		size_t size = (words * sizeof(int) + page - 1) / page * page;
+		if (!map || size > data_bytes) return false;
+		return mmap(map, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset) != MAP_FAILED;
+	}
+
+	void clear() // give all touched pages back, so they read as zero again
+	{
+		if (!map) return;
+		mmap(map, data_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0); // drops a mapped image too
+		madvise(map + data_bytes + MEM_GUARD_SIZE, stack_bytes, MADV_DONTNEED);
+	}
+
+	const char* fault(const void* addr) const // what a faulting access to 'addr' ran into, or nullptr
+	{
+		const char* a = static_cast<const char*>(addr);
+		if (!map || a < map + data_bytes) return nullptr;
+		if (a < map + data_bytes + MEM_GUARD_SIZE) return "stack overflow";
+		if (a < map + data_bytes + MEM_GUARD_SIZE + stack_bytes) return nullptr;
+		if (a < map + data_bytes + MEM_GUARD_SIZE * 2 + stack_bytes) return "memory access beyond the stack top";
+		return nullptr;
+	}
+
+	int& operator[](size_t i) { return reinterpret_cast<int*>(map)[i]; }
+	int* data() { return reinterpret_cast<int*>(map); }
+	size_t limit() const { return data_bytes / sizeof(int); } // words available for data & code
+	int stack_base() const { return static_cast<int>((data_bytes + MEM_GUARD_SIZE) / sizeof(int)); } // lowest word of the stack
+	size_t size() const { return (data_bytes + MEM_GUARD_SIZE + stack_bytes) / sizeof(int); } // initial sp
+};
+
+//--------------------------------------------------------//
+// source text
+//
+// a source file is mapped read-only and lexed in place, across line ends.
+// only listings and diagnostics look lines up by number, so the offsets of
+// the lines are indexed the first time they do.
+
+struct source_text {
+	shared_ptr<const char> data; // the mapped file, or the text kept in a string, followed by '\0'
+	size_t bytes = 0;
+	mutable vector<size_t> line_start; // offset of each line, see index()
+
+	const char* begin() const { return data.get(); }
+	const char* end() const { return data.get() + bytes; }
+
+	bool load(const string& filename)
+	{
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		void* a = MAP_FAILED;
+		size_t n = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) ? st.st_size : 0);
+		if (n > 0 && n % sysconf(_SC_PAGESIZE) != 0) { // the rest of the last page reads as '\0'
+			a = mmap(nullptr, n, PROT_READ, MAP_PRIVATE, fd, 0);
+		}
+		if (a != MAP_FAILED) {
+			data = shared_ptr<const char>(static_cast<const char*>(a), [n](const char* q) { munmap(const_cast<char*>(q), n); });
+			bytes = n;
+			line_start.clear();
+		} else { // empty, not a regular file, or no room for the '\0'
+			string text;
+			char buf[65536];
+			for (ssize_t k; (k = read(fd, buf, sizeof(buf))) > 0;) text.append(buf, k);
+			assign(move(text));
+		}
+		close(fd);
+		return true;
+	}
+
+	void assign(string text)
+	{
+		auto s = make_shared<string>(move(text));
+		data = shared_ptr<const char>(s, s->c_str());
+		bytes = s->size();
+		line_start.clear();
+	}
+
+	void index() const
+	{
+		if (!line_start.empty() || bytes == 0) return;
+		line_start.push_back(0);
+		for (const char* q = begin(); (q = static_cast<const char*>(memchr(q, '\n', end() - q))) && ++q != end();) {
+			line_start.push_back(q - begin());
+		}
+	}
+
+	size_t size() const { index(); return line_start.size(); } // number of lines
+
+	string_view operator[](size_t n) const // line n (from 0), without '\n'
+	{
+		index();
+		const char* s = begin() + line_start[n];
+		const char* e = (n + 1 < line_start.size() ? begin() + line_start[n + 1] - 1 : end());
+		if (e > s && e[-1] == '\n') --e;
+		return string_view(s, e - s);
+	}
+};
+
+//--------------------------------------------------------//
+// global variables
+//
+// all state of one program, while compiling and running it, is kept in a
+// compiler_context and a vm_context. every thread has its own pair, which
+// the names below refer to, so programs can be compiled and run on several
+// threads at once, and one after another with reset_context(). the pair is
+// not passed around, so a thread holds one program at a time: to keep two
+// apart, run them on two threads.
 
 enum token_type { unknown = 0, symbol, number, text, op };
 const char* token_type_text[] = { "unknown", "symbol", "number", "text", "op" };
 
-vector<string> src;
-const char* p = nullptr; // position of source code parsing
-size_t line_no = 0;
-token_type type = unknown;
-string token;
+typedef int (*native_handler)(int sp); // arguments are at m[sp], m[sp+1], ... (the last pushed first)
+struct native_function {
+	string name;
+	native_handler handler;
+	int pop; // number of words popped from stack after the call
+};
+
+enum type_kind { TYPE_BUILT_IN, TYPE_POINTER, TYPE_ARRAY, TYPE_FUNCTION };
+
+struct type_desc { // built once for each type name, see type_of()
+	type_kind kind;
+	string name;
+	const type_desc* element; // of a pointer or an array, after one '*' or '[]'
+	vector<int> dim; // of an array
+	vector<int> stride; // of an array, words between elements in each dimension
+	int size; // in words
+};
+
+// built-in types, shared by all programs, so that a type is checked by comparing descriptors
+const type_desc no_type = { TYPE_BUILT_IN, "", nullptr, {}, {}, 1 }; // of an expression with no value
+const type_desc int_type = { TYPE_BUILT_IN, "int", nullptr, {}, {}, 1 };
+const type_desc long_long_type = { TYPE_BUILT_IN, "long long", nullptr, {}, {}, 2 };
+const type_desc double_type = { TYPE_BUILT_IN, "double", nullptr, {}, {}, 2 };
+
+inline bool is_wide_type(const type_desc* t)
+{
+	return (t == &long_long_type || t == &double_type);
+}
+
+struct symbol_info {
+	bool is_code;
+	size_t offset; // in data or code section, or from bp for a local
+	size_t size;
+	const type_desc* type;
+	const type_desc* ret_type; // of a function, no_type for data
+	int arg_count;
+	size_t depth; // of the stack frame it is declared in, 0 for a global
+};
+
+struct symbol_entry { // an interned name
+	string name;
+	vector<symbol_info> bindings; // [ global, locals of enclosing stack frames ], the innermost last
+	vector<int> overloads; // ids of 'name(arg_types)', for a function
+};
+
+struct compiler_context {
+	source_text src;
+	const char* p = nullptr; // position of source code parsing
+	const char* line_end = nullptr; // end of the line p is in
+	size_t line_no = 0;
+	token_type type = unknown;
+	string token;
+	token_kind token_id = T_NONE; // of a keyword or an operator
+
+	vector<pair<string, string>> scopes; // [ < type, name > ]
+	unordered_set<string> returned_functions;
+
+	vector<int> code_sec;
+	vector<int> data_sec;
+
+	size_t external_data_size = 0;
+	size_t external_code_size = 0;
 
-vector<pair<string, string>> scopes; // [ < type, name > ]
-unordered_set<string> returned_functions;
+	// [ { offset-of-instru, [ ids of symbols declared in the stack frame ] } ]
+	vector<pair<int, vector<int>>> stack_frame_table;
+	unordered_map<size_t, string> comments;
 
-vector<int> code_sec;
-vector<int> data_sec;
+	vector<symbol_entry> symbols; // id => { name, bindings, overloads }
+	unordered_map<string, int> symbol_ids; // name => id
+	unordered_map<string, int> signature_ids; // arg_types => id, interned apart from names
+	unordered_map<int64_t, int> overload_index; // { id of name, id of arg_types } => id of 'name(arg_types)'
+	unordered_map<size_t, int> data_symbol_dict; // offset => id
+	unordered_map<size_t, int> code_symbol_dict; // offset => id
+	unordered_map<size_t, int> native_dict; // offset => index in natives
 
-size_t external_data_size = 0;
-size_t external_code_size = 0;
+	deque<type_desc> types; // arena, where descriptors do not move
+	unordered_map<string, const type_desc*> type_index; // name => descriptor
 
-// [ { offset-of-instru, [ symbol-name => { offset-in-stack-frame, size, type } ] } ]
-vector<pair<int, unordered_map<string, tuple<int, int, string>>>> stack_frame_table;
-unordered_map<size_t, string> comments;
+	unordered_map<size_t, pair<size_t, size_t>> offset; // line_no => [ offset_start, offset_end ]
 
-unordered_map<string, tuple<bool, size_t, size_t, string, string, int>> symbols; // name => { is_code, offset, size, type, ret_type, arg_count }
-unordered_map<size_t, string> data_symbol_dict; // offset => name
-unordered_map<size_t, string> code_symbol_dict; // offset => name
-unordered_map<string, unordered_set<string>> override_functions;
+	tuple<string, string, string, int> current_function; // name, arg_types, ret_type, arg_count
 
-unordered_map<string, pair<int, vector<int>>> symbol_dim; // name => [ size, dim ]
+	size_t ext_symbol_counter = 0;
+	size_t alloc_name_counter = 0;
+	size_t last_call_offset = SIZE_MAX; // offset of the last CALL, for add_tail_call()
+	size_t next_display_source_code = 0;
+	size_t next_display_instruction = 0;
 
-unordered_map<size_t, pair<size_t, size_t>> offset; // line_no => [ offset_start, offset_end ]
+	unordered_map<string, unordered_map<string, int>> enum_values; // enum-name => { name => value }
+	unordered_map<string, pair<string, int>> enum_types; // name => { enum-name, value }
 
-tuple<string, string, string, int> current_function; // name, arg_types, ret_type, arg_count
+	vector<native_function> natives; // index => bound external function, called by CALLX
+	vector<ostream*> native_streams; // offset => stream, for external 'ostream' data
 
-size_t ext_symbol_counter = 0;
+	// register backend
+	vector<int> reg_code;
+	unordered_map<size_t, string> reg_comments; // offset => comment
+	vector<pair<size_t, size_t>> reg_offset; // [ { offset in code_sec, offset in reg_code } ]
+	size_t reg_exit_addr = 0;
+};
+
+struct jit_state;
+typedef int (*jit_entry)(jit_state* st, const void* host); // returns guest ip to continue at
+
+struct vm_context {
+	vm_memory m; // allocated by load_program(), and kept by reset_context()
+	int image_fd = -1; // compiled image to map into m by load_program(), see load_snapshot()
+	size_t image_offset = 0;
+	bool image_unread = false; // data_sec & code_sec are left in the image, see read_image()
+	size_t image_data_size = 0, image_code_size = 0; // in words, while image_unread
+	size_t cycles = 0; // of the last run
+
+	ostream* cout_stream = &cout; // for guest 'cout' and printf()
+	ostream* cerr_stream = &cerr; // for guest 'cerr'
+
+	// jit compiler
+	jit_entry jit_enter = nullptr;
+	const void* jit_leave = nullptr; // stores vm registers back to jit_state, and returns
+	vector<const void*> jit_addr; // guest ip => host address, if compiled
+	vector<int> jit_calls; // guest ip => times called by run()
+	vector<pair<void*, size_t>> jit_buffers; // mmap'ed code, released by reset_context()
+
+	// handler address of each loaded word, for run() and run_reg() in [0], and for each cache
+	// state of run_tos(). kept here, as a fault leaves the VM loops by siglongjmp() (see execute())
+	vector<const void*> decoded[3];
+
+	// execution profile
+	vector<size_t> profile_ops = vector<size_t>(INVALID + 1); // instruction => times executed
+	vector<size_t> profile_pairs = vector<size_t>((INVALID + 1) * (INVALID + 1)); // prev * (INVALID + 1) + next => times executed
+	vector<size_t> profile_code; // loaded address => times executed
+};
 
-size_t next_display_source_code = 0;
-size_t next_display_instruction = 0;
+thread_local compiler_context compiler;
+thread_local vm_context vm;
 
-unordered_map<string, unordered_map<string, int>> enum_values; // enum-name => { name => value }
-unordered_map<string, pair<string, int>> enum_types; // name => { enum-name, value }
+thread_local auto& src = compiler.src;
+thread_local auto& p = compiler.p;
+thread_local auto& line_end = compiler.line_end;
+thread_local auto& line_no = compiler.line_no;
+thread_local auto& type = compiler.type;
+thread_local auto& token = compiler.token;
+thread_local auto& token_id = compiler.token_id;
+thread_local auto& scopes = compiler.scopes;
+thread_local auto& returned_functions = compiler.returned_functions;
+thread_local auto& code_sec = compiler.code_sec;
+thread_local auto& data_sec = compiler.data_sec;
+thread_local auto& external_data_size = compiler.external_data_size;
+thread_local auto& external_code_size = compiler.external_code_size;
+thread_local auto& stack_frame_table = compiler.stack_frame_table;
+thread_local auto& comments = compiler.comments;
+thread_local auto& symbols = compiler.symbols;
+thread_local auto& symbol_ids = compiler.symbol_ids;
+thread_local auto& signature_ids = compiler.signature_ids;
+thread_local auto& overload_index = compiler.overload_index;
+thread_local auto& data_symbol_dict = compiler.data_symbol_dict;
+thread_local auto& code_symbol_dict = compiler.code_symbol_dict;
+thread_local auto& native_dict = compiler.native_dict;
+thread_local auto& types = compiler.types;
+thread_local auto& type_index = compiler.type_index;
+thread_local auto& offset = compiler.offset;
+thread_local auto& current_function = compiler.current_function;
+thread_local auto& ext_symbol_counter = compiler.ext_symbol_counter;
+thread_local auto& last_call_offset = compiler.last_call_offset;
+thread_local auto& next_display_source_code = compiler.next_display_source_code;
+thread_local auto& next_display_instruction = compiler.next_display_instruction;
+thread_local auto& enum_values = compiler.enum_values;
+thread_local auto& enum_types = compiler.enum_types;
+thread_local auto& natives = compiler.natives;
+thread_local auto& native_streams = compiler.native_streams;
+thread_local auto& reg_code = compiler.reg_code;
+thread_local auto& reg_comments = compiler.reg_comments;
+thread_local auto& reg_offset = compiler.reg_offset;
+thread_local auto& reg_exit_addr = compiler.reg_exit_addr;
+
+thread_local auto& m = vm.m;
+thread_local auto& jit_enter = vm.jit_enter;
+thread_local auto& jit_leave = vm.jit_leave;
+thread_local auto& jit_addr = vm.jit_addr;
+thread_local auto& jit_calls = vm.jit_calls;
+thread_local auto& profile_ops = vm.profile_ops;
+thread_local auto& profile_pairs = vm.profile_pairs;
+thread_local auto& profile_code = vm.profile_code;
+
+// a cached (or restored) program only runs from its image mapped into vm memory, so data_sec
+// and code_sec are read from it only for what looks at the code itself, see read_image()
+
+size_t data_sec_size() { return vm.image_unread ? vm.image_data_size : data_sec.size(); } // in words
+size_t code_sec_size() { return vm.image_unread ? vm.image_code_size : code_sec.size(); }
+
+bool read_image() // fill data_sec & code_sec from the image they were left in, if any
+{
+	if (!vm.image_unread) return true;
+	vm.image_unread = false;
+	data_sec.resize(vm.image_data_size);
+	code_sec.resize(vm.image_code_size);
+	ssize_t data_bytes = data_sec.size() * sizeof(int), code_bytes = code_sec.size() * sizeof(int);
+	if (pread(vm.image_fd, data_sec.data(), data_bytes, vm.image_offset) != data_bytes
+			|| pread(vm.image_fd, code_sec.data(), code_bytes, vm.image_offset + data_bytes) != code_bytes) {
+		err("failed to read the compiled image!\n");
+		return false;
+	}
+	return true;
+}
 
 void dump_enum()
 {
@@ -175,8 +745,8 @@ void dump_enum()
 void print_source_code_line(size_t n)
 {
 	log("%4zd ", n + 1);
-	for (const char* p = src[n].c_str(); *p; ++p) {
-		if (*p == '\t') log("    "); else log("%c", *p);
+	for (char c : src[n]) {
+		if (c == '\t') log("    "); else log("%c", c);
 	}
 	log("\n");
 }
@@ -187,7 +757,8 @@ void print_current(bool with_source_code = true)
 		print_source_code_line(line_no - 1);
 	}
 	log("     ");
-	for (const char* q = src[line_no - 1].c_str(); *q && q + token.size() != p; ++q) {
+	string_view line = src[line_no - 1];
+	for (const char* q = line.data(); q < line.data() + line.size() && q + token.size() != p; ++q) {
 		if (*q == '\t') log("    "); else log(" ");
 	}
 	for (size_t i = 0; i < token.size(); ++i) {
@@ -198,27 +769,123 @@ void print_current(bool with_source_code = true)
 
 void print_current_and_exit()
 {
-	print_current();
+	if (line_no > 0 && line_no <= src.size()) print_current();
 	exit(1);
 }
 
-void add_symbol(string name, bool is_code, size_t offset, size_t size, string type, string ret_type, int arg_count)
+string array_suffix(const vector<int>& dim)
+{
+	string s; for (auto e : dim) s += "[" + to_string(e) + "]"; return s;
+}
+
+const type_desc* type_of(const string& name) // the same descriptor for the same name, with element types built along
+{
+	auto it = type_index.find(name);
+	if (it != type_index.end()) return it->second;
+	for (const type_desc* b : { &no_type, &int_type, &long_long_type, &double_type }) {
+		if (name == b->name) return type_index.insert(make_pair(name, b)).first->second;
+	}
+	type_desc t = { TYPE_BUILT_IN, name, nullptr, {}, {}, 1 };
+	if (name.compare(0, 4, "(*)(") == 0) { // address of a function
+		t.kind = TYPE_FUNCTION;
+	} else if (!name.empty() && name.back() == '*') {
+		size_t n = name.size() - 1;
+		while (n > 0 && name[n - 1] == ' ') --n;
+		t.kind = TYPE_POINTER;
+		t.element = type_of(name.substr(0, n));
+	} else if (!name.empty() && name.back() == ']') { // 'int[3][4]'
+		size_t k = name.find('[');
+		const type_desc* base = type_of(name.substr(0, k));
+		t.kind = TYPE_ARRAY;
+		for (const char* q = name.c_str() + k; *q == '['; q = strchr(q, ']') + 1) {
+			t.dim.push_back(atoi(q + 1));
+		}
+		t.stride.resize(t.dim.size());
+		t.size = base->size;
+		for (size_t i = t.dim.size(); i > 0; --i) {
+			t.stride[i - 1] = t.size;
+			t.size *= t.dim[i - 1];
+		}
+		t.element = (t.dim.size() == 1 ? base : type_of(base->name + array_suffix(vector<int>(t.dim.begin() + 1, t.dim.end()))));
+	}
+	types.push_back(t);
+	type_index.insert(make_pair(name, &types.back()));
+	return &types.back();
+}
+
+int symbol_id(const string& name) // interned once, so that later lookups are by index
+{
+	auto it = symbol_ids.find(name);
+	if (it != symbol_ids.end()) return it->second;
+	symbol_ids.insert(make_pair(name, static_cast<int>(symbols.size())));
+	symbols.push_back({ name, {}, {} });
+	return static_cast<int>(symbols.size() - 1);
+}
+
+int signature_id(const string& arg_types) // of a function, interned apart from the symbols
+{
+	return signature_ids.insert(make_pair(arg_types, static_cast<int>(signature_ids.size()))).first->second;
+}
+
+int64_t overload_key(int name_id, int arg_types_id)
+{
+	return (static_cast<int64_t>(name_id) << 32) | static_cast<uint32_t>(arg_types_id);
+}
+
+symbol_info& global_symbol(int id)
+{
+	auto& b = symbols[id].bindings;
+	if (b.empty() || b.front().depth != 0) err("unknown symbol '%s'!\n", symbols[id].name.c_str());
+	return b.front();
+}
+
+symbol_info& global_symbol(const string& name)
+{
+	return global_symbol(symbol_id(name));
+}
+
+const symbol_info* find_function(const string& name, const string& arg_types) // overload 'name(arg_types)', if any
+{
+	auto a = symbol_ids.find(name);
+	auto b = signature_ids.find(arg_types);
+	if (a == symbol_ids.end() || b == signature_ids.end()) return nullptr;
+	auto it = overload_index.find(overload_key(a->second, b->second));
+	return (it == overload_index.end() ? nullptr : &global_symbol(it->second));
+}
+
+void add_symbol(string name, bool is_code, size_t offset, size_t size, const type_desc* type, const type_desc* ret_type, int arg_count)
 {
 	log<3>("[DEBUG] add %s symbol: '%s', offset=%zd, size=%zd, type='%s', ret_type='%s', arg_count = %d\n",
 			(is_code ? "code" : "data"), name.c_str(),
-			offset, size, type.c_str(), ret_type.c_str(), arg_count);
-	symbols[name] = make_tuple(is_code, offset, size, type, ret_type, arg_count);
+			offset, size, type->name.c_str(), ret_type->name.c_str(), arg_count);
+	int id = symbol_id(name);
+	auto& b = symbols[id].bindings;
+	symbol_info info = { is_code, offset, size, type, ret_type, arg_count, 0 };
+	if (!b.empty() && b.front().depth == 0) {
+		b.front() = info;
+	} else {
+		b.insert(b.begin(), info); // below locals of the same name, if any
+	}
 	if (is_code) {
-		code_symbol_dict.insert(make_pair(offset, name));
+		code_symbol_dict.insert(make_pair(offset, id));
 	} else {
-		data_symbol_dict.insert(make_pair(offset, name));
+		data_symbol_dict.insert(make_pair(offset, id));
 	}
 }
 
-size_t add_const_string(string name, vector<int> val, string type)
+void add_overload(string name, string arg_types) // of a code symbol 'name(arg_types)'
+{
+	int id = symbol_id(name);
+	int f = symbol_id(name + "(" + arg_types + ")");
+	auto& v = symbols[id].overloads;
+	if (find(v.begin(), v.end(), f) == v.end()) v.push_back(f);
+	overload_index[overload_key(id, signature_id(arg_types))] = f;
+}
+
+size_t add_const_string(string name, vector<int> val, const type_desc* type)
 {
 	size_t offset = data_sec.size();
-	add_symbol(name, false, offset, val.size(), type, "", 0);
+	add_symbol(name, false, offset, val.size(), type, &no_type, 0);
 	data_sec.insert(data_sec.end(), val.begin(), val.end());
 	return offset;
 }
@@ -228,20 +895,35 @@ bool is_global_variable()
 	return stack_frame_table.empty();
 }
 
-auto add_variable(string name, int size, string type) -> pair<bool, size_t> // { is-global, offset }
+void add_local(string name, size_t offset, int size, const type_desc* type) // shadows any symbol of the same name, until its stack frame is left
+{
+	int id = symbol_id(name);
+	symbols[id].bindings.push_back({ false, offset, static_cast<size_t>(size), type, &no_type, 0, stack_frame_table.size() });
+	stack_frame_table.back().second.push_back(id);
+}
+
+void leave_stack_frame()
+{
+	for (int id : stack_frame_table.back().second) {
+		symbols[id].bindings.pop_back();
+	}
+	stack_frame_table.pop_back();
+}
+
+auto add_variable(string name, int size, const type_desc* type) -> pair<bool, size_t> // { is-global, offset }
 {
 	log<3>("[DEBUG] add variable '%s', size = %d, type = '%s'\n",
-			name.c_str(), size, type.c_str());
+			name.c_str(), size, type->name.c_str());
 	if (stack_frame_table.empty()) {
 		size_t offset = data_sec.size();
-		add_symbol(name, false, offset, size, type, "", 0);
+		add_symbol(name, false, offset, size, type, &no_type, 0);
 		data_sec.resize(data_sec.size() + size);
 		return make_pair(true, offset);
 	} else {
 		size_t stack_frame_offset = stack_frame_table.back().first;
 		code_sec[stack_frame_offset] += size;
 		size_t symbol_offset = -code_sec[stack_frame_offset];
-		stack_frame_table.back().second.insert(make_pair(name, make_tuple(symbol_offset, size, type)));
+		add_local(name, symbol_offset, size, type);
 		return make_pair(false, symbol_offset);
 	}
 }
@@ -251,36 +933,34 @@ void print_stack_frame()
 	if (verbose >= 4) {
 		log("[DEBUG] current stack frame has %zd variable\n", stack_frame_table.back().second.size());
 		size_t i = 0;
-		for (auto it = stack_frame_table.back().second.begin();
-				it != stack_frame_table.back().second.end();
-				++it) {
-			auto [ offset, size, type ] = it->second;
-			log("[DEBUG] [%zd] '%s': offset=%d, size=%d, type='%s'\n", i++, it->first.c_str(), offset, size, type.c_str());
+		for (int id : stack_frame_table.back().second) {
+			const auto& e = symbols[id].bindings.back();
+			log("[DEBUG] [%zd] '%s': offset=%d, size=%zd, type='%s'\n", i++, symbols[id].name.c_str(),
+					static_cast<int>(e.offset), e.size, e.type->name.c_str());
 		}
 	}
 }
 
-void add_argument(string name, string type, size_t offset)
+void add_argument(string name, const type_desc* type, size_t offset)
 {
-	log<3>("[DEBUG] add argument '%s', type = '%s'\n", name.c_str(), type.c_str());
-	auto& stack_frame = stack_frame_table.back().second;
-	stack_frame.insert(make_pair(name, make_tuple(offset, 1, type)));
+	log<3>("[DEBUG] add argument '%s', type = '%s'\n", name.c_str(), type->name.c_str());
+	add_local(name, offset, (is_wide_type(type) ? 2 : 1), type);
 	print_stack_frame();
 }
 
 void add_code_symbol(string name, string args_type, string ret_type, int arg_count)
 {
-	override_functions[name].insert(name + args_type);
-	add_symbol(name + args_type, true, code_sec.size(), 0, args_type, ret_type, arg_count);
+	add_symbol(name + args_type, true, code_sec.size(), 0, type_of("(*)(" + args_type + ")"), type_of(ret_type), arg_count);
+	add_overload(name, args_type.substr(1, args_type.size() - 2)); // without '(' and ')'
 }
 
-size_t print_code(const vector<int>& mem, size_t ip, size_t code_loading_position = 0)
+size_t print_code(const int* mem, size_t ip, size_t code_loading_position = 0)
 {
 	size_t code_offset = ip;
 	log(COLOR_YELLOW "%-10zd" COLOR_BLUE, ip);
 	size_t i = mem[ip++];
 	if (i < INVALID) {
-		log("%-14.6s", &instruction_name[i * 6]);
+		log("%-14s", instruction_name[i]);
 	} else {
 		log("<0x%08zX>  ", i);
 	}
@@ -292,7 +972,7 @@ size_t print_code(const vector<int>& mem, size_t ip, size_t code_loading_positio
 		auto it = comments.find(code_offset - code_loading_position);
 		if (it != comments.end()) {
 			log(" ; %s", it->second.c_str());
-		} else if (i == CALL || i == JMP || i == JZ || i == JNZ) {
+		} else if (instruction_is_jump(i)) {
 			log(" ; address %d", ip + v);
 		}
 	}
@@ -311,7 +991,7 @@ size_t add_assembly_code(instruction code, int param = 0, string comment = "")
 	size_t code_offset = code_sec.size();
 	code_sec.push_back(code);
 	if (instruction_has_parameter(code)) {
-		if (code == CALL || code == JMP || code == JZ || code == JNZ) {
+		if (instruction_is_jump(code)) {
 			param -= code_sec.size() + 1; // use relative address
 		}
 		code_sec.push_back(param);
@@ -323,7 +1003,7 @@ size_t add_assembly_code(instruction code, int param = 0, string comment = "")
 		if (next_display_instruction < code_sec.size()) {
 			log(COLOR_BLUE);
 			while (next_display_instruction < code_sec.size()) {
-				next_display_instruction = print_code(code_sec, next_display_instruction);
+				next_display_instruction = print_code(code_sec.data(), next_display_instruction);
 			}
 			log(COLOR_NORMAL);
 		}
@@ -338,7 +1018,8 @@ void update_relative_address_here(size_t instrument_offset)
 	code_sec[instrument_offset + 1] = code_sec.size() - (instrument_offset + 2);
 }
 
-void add_external_symbol(string name, string args_type, string ret_type = "", int arg_count = 0)
+void add_external_symbol(string name, string args_type, string ret_type = "", int arg_count = 0,
+		native_handler handler = nullptr)
 {
 	// for variable arguments, arg_count is negative, and the number is fixed arguments.
 	// for example
@@ -348,17 +1029,51 @@ void add_external_symbol(string name, string args_type, string ret_type = "", in
 	//   the number, as in stdcall calling convention (which means the arguments are pushed into
 	//   stack as the order in source code, and this interpreter follows this rule), could be
 	//   found as [bp + 1] in subroutine (before ENTER)
+	// code symbols are bound to 'handler' in table 'natives', and call sites use CALLX with the
+	// index. the 'RET' stub only gives the function an address (e.g. for `cout << endl`).
 	if (ret_type.empty()) { // data
 		size_t offset = data_sec.size();
-		add_symbol(name, false, offset, 1, args_type, "", 0);
+		add_symbol(name, false, offset, 1, type_of(args_type), &no_type, 0);
 		data_sec.resize(offset + 1);
 	} else { // code
 		size_t offset = code_sec.size();
 		string name_with_args = name + "(" + args_type + ")";
-		override_functions[name].insert(name_with_args);
-		add_symbol(name_with_args, true, offset, 2, args_type, ret_type, arg_count);
+		add_symbol(name_with_args, true, offset, 2, type_of("(*)(" + args_type + ")"), type_of(ret_type), arg_count);
+		add_overload(name, args_type);
 		add_assembly_code(RET, (arg_count >= 0 ? arg_count : 0), ret_type + " " + name_with_args);
+		native_dict.insert(make_pair(offset, natives.size()));
+		natives.push_back({ name_with_args, handler, (arg_count >= 0 ? arg_count : 1) });
+	}
+}
+
+size_t add_call_code(size_t offset, string comment)
+{
+	auto it = native_dict.find(offset);
+	if (it == native_dict.end()) {
+		return last_call_offset = add_assembly_code(CALL, offset, comment);
+	}
+	if (!natives[it->second].handler) {
+		err("function '%s' is not supported yet!\n", natives[it->second].name.c_str());
 	}
+	return add_assembly_code(CALLX, it->second, comment);
+}
+
+bool add_tail_call() // replace `CALL f` just generated by `TAILCALL n; JMP f`, if f takes as many arguments
+{
+	if (last_call_offset + 2 != code_sec.size()) return false;
+	size_t target = last_call_offset + 2 + code_sec[last_call_offset + 1];
+	auto it = code_symbol_dict.find(target);
+	if (it == code_symbol_dict.end()) return false;
+	int n = global_symbol(it->second).arg_count;
+	if (n != get<3>(current_function)) return false;
+
+	string comment = comments[last_call_offset];
+	comments.erase(last_call_offset);
+	code_sec.resize(last_call_offset);
+	next_display_instruction = min(next_display_instruction, code_sec.size());
+	add_assembly_code(TAILCALL, n);
+	add_assembly_code(JMP, target, comment);
+	return true;
 }
 
 vector<int> prepare_string(const string& s)
@@ -372,34 +1087,51 @@ vector<int> prepare_string(const string& s)
 
 string alloc_name()
 {
-	static size_t counter = 0;
-	return "@" + to_string(++counter);
+	return "@" + to_string(++compiler.alloc_name_counter);
 }
 
 void next()
 {
-	bool in_comment = false;
 retry:
-	if (!p || !*p) {
-		if (line_no >= src.size()) { token = ""; type = unknown; goto end; } // end of source code
-		p = src[line_no++].c_str(); while (*p == ' ' || *p == '\t') ++p;   // next line and skip leading spaces
-		if (*p == '#') { while (*p) ++p; goto retry; }                     // skip '#'-leading line
-		if (!*p) goto retry;
-	}
-	if (in_comment) { while (*p) { if (*p == '*' && *(p+1) == '/') { p += 2; in_comment = false; goto retry; }; ++p; }; goto retry; } // skip '/* ... */' comments
-	if (*p == ' ' || *p == '\t') { ++p; while (*p && (*p == ' ' || *p == '\t')) ++p; goto retry; } // skip spaces
-	if (*p == '/' && *(p+1) == '/') { p += 2; while (*p) ++p; goto retry; } // skip '// ...' comments
-	if (*p == '/' && *(p+1) == '*') { p += 2; in_comment = true; goto retry; } // found '/* ... */' comments
-	if (*p == '_' || (*p >= 'a' && *p <= 'z') || (*p >= 'a' && *p <= 'z')) { // symbol
-		type = symbol; token = *p++; while (*p == '_' || (*p >= 'a' && *p <= 'z') || (*p >= 'a' && *p <= 'z')) token += *p++;
-	} else if ((*p >= '0' && *p <= '9') || (*p == '.' && *(p+1) >= '0' && *(p+1) <= '9')) { // number
-		type = number; token = *p++; while ((*p >= '0' && *p <= '9') || (*p == '.') || (*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z')) token += *p++;
-	} else if (*p == '\"' || *p == '\'') { // string
-		type = text; char c = *p; token = *p++; while (*p && *p != c) { if (*p == '\\') { token += *p++; }; token += *p++; } token += *p++;
-	} else { // operator
-		static const char* ops[] = { "==", "=", "!=", "!", "++", "+=", "+", "--", "-=", "->*", "->", "-", "<=>", "<=", "<<=", "<<", "<", ">=", ">>=", ">>", ">",
-			"||", "|=", "|", "&&", "&=", "&", "::", ":", "^", "*=", "*", "/=", "/", "%=", "%", "?", "~=", "~", ";", ".*", ".", "{", "}", "[", "]", "(", ")", ",", nullptr };
-		for (const char** q = ops; *q; ++q) { size_t l = strlen(*q); if (memcmp(p, *q, l) == 0) { type = op; token = *q; p += l; goto end; } }
+	if (!p || p == line_end) {
+		const char* q = (p ? line_end + 1 : src.begin());
+		if (q >= src.end()) { token = ""; type = unknown; token_id = T_NONE; goto end; } // end of source code
+		++line_no;
+		p = q; line_end = static_cast<const char*>(memchr(p, '\n', src.end() - p));
+		if (!line_end) line_end = src.end();
+		p = skip_bytes(p, line_end, ' ', '\t');   // next line and skip leading spaces
+		if (*p == '#') { p = line_end; goto retry; } // skip '#'-leading line
+		if (p == line_end) goto retry;
+	}
+	if (char_classes[*p] & CC_BLANK) { p = skip_bytes(p, line_end, ' ', '\t'); goto retry; } // skip spaces
+	if (*p == '/' && *(p+1) == '/') { p = line_end; goto retry; } // skip '// ...' comments
+	if (*p == '/' && *(p+1) == '*') { // skip '/* ... */' comments, which may span lines
+		const char* q = p + 2;
+		while ((q = find_bytes(q, src.end(), '*', '*')) != src.end() && *++q != '/');
+		if (q > line_end) { // ends on a later line
+			line_no += count(line_end, q, '\n');
+			line_end = static_cast<const char*>(memchr(q, '\n', src.end() - q));
+			if (!line_end) line_end = src.end();
+		}
+		p = (q == src.end() ? q : q + 1);
+		goto retry;
+	}
+	if (char_classes[*p] & CC_SYMBOL) { // symbol
+		const char* start = p; while (char_classes[*++p] & CC_SYMBOL);
+		type = symbol; token.assign(start, p); token_id = tokens.match_keyword(start, p);
+	} else if ((char_classes[*p] & CC_DIGIT) || (*p == '.' && (char_classes[*(p+1)] & CC_DIGIT))) { // number
+		const char* start = p; while (char_classes[*++p] & CC_NUMBER);
+		type = number; token.assign(start, p); token_id = T_NONE;
+	} else if (*p == '\"' || *p == '\'') { // string, up to the same quote not escaped by '\'
+		const char* start = p++;
+		while ((p = find_bytes(p, line_end, *start, '\\')) != line_end) {
+			if (*p++ == *start) break;
+			if (p != line_end) ++p; // the escaped one
+		}
+		type = text; token.assign(start, p); token_id = T_NONE;
+	} else if ((token_id = tokens.match_operator(p)) != T_NONE) { // operator
+		type = op; token = token_kind_text[token_id];
+	} else {
 		type = unknown; token = *p++;
 	}
 end:
@@ -416,18 +1148,18 @@ end:
 	}
 }
 
-void expect_token(string expected_token, string statement)
+void expect_token(token_kind expected_token, string statement)
 {
-	if (token != expected_token) {
+	if (token_id != expected_token) {
 		err("missing '%s' for '%s'! current token: '%s'\n",
-				expected_token.c_str(), statement.c_str(), token.c_str());
+				token_kind_text[expected_token], statement.c_str(), token.c_str());
 	}
 }
 
-void skip_until(string expected_token, string stat)
+void skip_until(token_kind expected_token, string stat)
 {
 	next();
-	while (!token.empty() && token != expected_token) {
+	while (!token.empty() && token_id != expected_token) {
 		next();
 	}
 	if (token.empty()) {
@@ -435,21 +1167,16 @@ void skip_until(string expected_token, string stat)
 	}
 }
 
-int precedence(string token)
+int precedence(token_kind kind, const string& text) // text of the operator, for the error
 {
-	auto it = operator_precedence.find(token);
-	if (it == operator_precedence.end()) {
-		err("unknown operator '%s'!\n", token.c_str());
+	int n = token_precedence.p[kind];
+	if (!n) {
+		err("unknown operator '%s'!\n", text.c_str());
 	}
-	return it->second;
-}
-
-string vector_to_string(const vector<string>& a, string sep = ",")
-{
-	string s; for (auto e : a) s += (s.empty() ? "" : sep) + e; return s;
+	return n;
 }
 
-int eval_number(string s) // TODO: support long long and float/double
+int eval_number(string s) // for 'int' literals, see number_type()
 {
 	int n = 0;
 	bool minus = false;
@@ -497,38 +1224,34 @@ string eval_string(string s)
 
 bool is_built_in_type()
 {
-	return (token == "char" || token == "short" || token == "int" ||
-			token == "long" || token == "longlong" ||
-			token == "float" || token == "double" ||
-			token == "signed" || token == "unsigned" ||
-			token == "size_t");
+	return (token_id >= T_CHAR && token_id <= T_SIZE_T);
 }
 
 string parse_type_name()
 {
 	string prefix;
-	if (token == "static" || token == "extern") {
+	if (token_id == T_STATIC || token_id == T_EXTERN) {
 		prefix = token;
 		next(); // skip this prefix
 	}
 	string type_name;
-	if (token == "auto") {
+	if (token_id == T_AUTO) {
 		type_name = token; next();
 	} else {
 		vector<pair<token_type, string>> a;
 		int angle_bracket = 0;
-		while (token == "const" || is_built_in_type() ||
-				token == "*" || token == "&" ||
-				token == "<" || token == ">" || token == ">>") {
-			if (token == "<") {
+		while (token_id == T_CONST || is_built_in_type() ||
+				token_id == T_MUL || token_id == T_AND ||
+				token_id == T_LT || token_id == T_GT || token_id == T_SHR) {
+			if (token_id == T_LT) {
 				++angle_bracket;
 				a.push_back(make_pair(type, token));
 				next();
-			} else if (token == ">") {
+			} else if (token_id == T_GT) {
 				if (--angle_bracket < 0) { err("unexpected '>'!\n"); }
 				a.push_back(make_pair(type, token));
 				next();
-			} else if (token == ">>") {
+			} else if (token_id == T_SHR) {
 				if (angle_bracket < 2) { err("unexpected '>>'!\n"); }
 				angle_bracket -= 2;
 				a.push_back(make_pair(type, ">"));
@@ -551,419 +1274,538 @@ string parse_type_name()
 	if (type_name == "size_t") { // TODO: support typedef
 		type_name = "int";
 	}
+	static const unordered_map<string, string> wide_aliases = {
+		{ "long", "long long" }, { "long int", "long long" }, { "long long int", "long long" },
+		{ "float", "double" }, { "long double", "double" },
+	};
+	string base = (type_name.compare(0, 6, "const ") == 0 ? type_name.substr(6) : type_name);
+	auto it = wide_aliases.find(base);
+	if (it != wide_aliases.end() || is_wide_type(base)) { // as 'long long' or 'double' (const is not checked)
+		type_name = (it != wide_aliases.end() ? it->second : base);
+	}
 	return type_name;
 }
 
-auto query_function(string name, vector<string>& arg_types) -> tuple<size_t, string, bool, string, int> // offset, arg_types, is_code, type_name, arg_count
+auto query_function(const string& name, const vector<const type_desc*>& arg_types) -> tuple<size_t, const type_desc*, bool, string, int> // offset, ret_type, is_code, type_name, arg_count
 {
-	auto it = override_functions.find(name);
-	if (it == override_functions.end()) {
+	auto it = symbol_ids.find(name);
+	if (it == symbol_ids.end() || symbols[it->second].overloads.empty()) {
 		err("function '%s' not defined!\n", name.c_str());
 	}
 	string type_name;
 	if (name == "printf") {
 		if (arg_types.empty()) err("missing parameter in printf()!\n");
-		type_name = arg_types[0] + ",...";
+		type_name = arg_types[0]->name + ",...";
 	} else {
-		type_name = vector_to_string(arg_types);
+		for (auto t : arg_types) type_name += (type_name.empty() ? "" : ",") + t->name;
 	}
-	for (auto it2 = it->second.begin(); it2 != it->second.end(); ++it2) {
-		if (*it2 == name + "(" + type_name + ")") {
-			auto it3 = symbols.find(*it2);
-			if (it3 == symbols.end()) {
-				err("unexpected runtime error!\n");
-			}
-			auto [ is_code, offset, size, symbol_type_name, ret_type, arg_count ] = it3->second;
-			return make_tuple(offset, ret_type, is_code, type_name, arg_count);
-		}
+	const symbol_info* f = find_function(name, type_name);
+	if (!f) {
+		err("function '%s' not matched!\n", name.c_str());
 	}
-	err("function '%s' not matched!\n", name.c_str());
-	exit(1);
+	return make_tuple(f->offset, f->ret_type, f->is_code, type_name, f->arg_count);
 }
 
-auto query_symbol(string s) -> tuple<bool, size_t, string, bool> // { is_global, offset, name, is_code }
+auto query_symbol(const string& s) -> tuple<bool, size_t, const type_desc*, bool> // { is_global, offset, type, is_code }
 {
 	log<4>("[DEBUG] query symbol: '%s'\n", s.c_str());
 	print_stack_frame();
 
-	bool found = false;
-	bool is_global = false;
-	size_t offset = 0;
-	string type_name;
-	bool is_code = false;
-	for (size_t i = stack_frame_table.size(); i > 0; --i) {
-		auto& stack_frame = stack_frame_table[i - 1].second;
-		auto it = stack_frame.find(s);
-		if (it != stack_frame.end()) {
-			found = true;
-			is_global = false;
-			offset = get<0>(it->second);
-			type_name = get<2>(it->second);
-			break;
-		}
+	auto it = symbol_ids.find(s);
+	if (it == symbol_ids.end()) {
+		err("unknown symbol '%s'!\n", s.c_str());
 	}
-	if (!found) {
-		is_global = true;
-		auto it = symbols.find(s);
-		if (it == symbols.end()) {
-			auto it2 = override_functions.find(s);
-			if (it2 == override_functions.end() || it2->second.empty()) {
-				err("unknown symbol '%s'!\n", s.c_str());
-			}
-			if (it2->second.size() > 1) {
-				err("undetermined override symbol '%s'!\n", s.c_str());
-			}
-			it = symbols.find(*(it2->second.begin()));
-			if (it == symbols.end()) {
-				err("unknown symbol '%s'!\n", s.c_str());
-			}
-		}
-		auto [ is_code_2, offset_2, size, t, ret_type, arg_count ] = it->second;
-		is_code = is_code_2;
-		offset = offset_2;
-		type_name = t;
+	const symbol_entry& e = symbols[it->second];
+	const symbol_info* info = nullptr;
+	if (!e.bindings.empty()) {
+		info = &e.bindings.back(); // the innermost one
+	} else if (e.overloads.size() == 1) {
+		info = &global_symbol(e.overloads[0]);
+	} else if (e.overloads.size() > 1) {
+		err("undetermined override symbol '%s'!\n", s.c_str());
+	} else {
+		err("unknown symbol '%s'!\n", s.c_str());
 	}
+	bool is_global = (info->depth == 0);
 	log<3>("[DEBUG] symbol '%s': '%s', type='%s', offset=%zd, type='%s'\n",
-			s.c_str(), (is_code ? "code" : "data"), (is_global ? "global" : "local"), offset, type_name.c_str());
-	return make_tuple(is_global, offset, type_name, is_code);
-}
-
-string build_code_for_op2(string a_type, string op_name, string b_type)
-{
-	if      (op_name == "+=" ) add_assembly_code(ADD);
-	else if (op_name == "-=" ) add_assembly_code(SUB);
-	else if (op_name == "*=" ) add_assembly_code(MUL);
-	else if (op_name == "/=" ) add_assembly_code(DIV);
-	else if (op_name == "%=" ) add_assembly_code(MOD);
-	else if (op_name == "<<=") add_assembly_code(SHL);
-	else if (op_name == ">>=") add_assembly_code(SHR);
-	else if (op_name == "&=" ) add_assembly_code(AND);
-	else if (op_name == "|=" ) add_assembly_code(OR);
-	else if (op_name == "&&=") add_assembly_code(LAND);
-	else if (op_name == "||=") add_assembly_code(LOR);
-	else err("Unsupported operator '%s'\n", op_name.c_str());
-	return "int";
-}
-
-string build_code_for_op(string a_type, string op_name, string b_type)
-{
-	if (a_type == "int" && b_type == "int") {
-		if      (op_name == "+" ) add_assembly_code(ADD);
-		else if (op_name == "-" ) add_assembly_code(SUB);
-		else if (op_name == "*" ) add_assembly_code(MUL);
-		else if (op_name == "/" ) add_assembly_code(DIV);
-		else if (op_name == "%" ) add_assembly_code(MOD);
-		else if (op_name == "<<") add_assembly_code(SHL);
-		else if (op_name == ">>") add_assembly_code(SHR);
-		else if (op_name == "&" ) add_assembly_code(AND);
-		else if (op_name == "|" ) add_assembly_code(OR);
-		else if (op_name == "==") add_assembly_code(EQ);
-		else if (op_name == "!=") add_assembly_code(NE);
-		else if (op_name == ">=") add_assembly_code(GE);
-		else if (op_name == ">" ) add_assembly_code(GT);
-		else if (op_name == "<=") add_assembly_code(LE);
-		else if (op_name == "<" ) add_assembly_code(LT);
-		else if (op_name == "&&") add_assembly_code(LAND);
-		else if (op_name == "||") add_assembly_code(LOR);
-		else err("Unsupported operator '%s'\n", op_name.c_str());
-		return "int";
+			s.c_str(), (info->is_code ? "code" : "data"), (is_global ? "global" : "local"), info->offset, info->type->name.c_str());
+	return make_tuple(is_global, info->offset, info->type, info->is_code);
+}
+
+const type_desc* build_code_for_op2(token_kind op)
+{
+	switch (op) {
+	case T_ADD_ASSIGN: add_assembly_code(ADD); break;
+	case T_SUB_ASSIGN: add_assembly_code(SUB); break;
+	case T_MUL_ASSIGN: add_assembly_code(MUL); break;
+	case T_DIV_ASSIGN: add_assembly_code(DIV); break;
+	case T_MOD_ASSIGN: add_assembly_code(MOD); break;
+	case T_SHL_ASSIGN: add_assembly_code(SHL); break;
+	case T_SHR_ASSIGN: add_assembly_code(SHR); break;
+	case T_AND_ASSIGN: add_assembly_code(AND); break;
+	case T_OR_ASSIGN:  add_assembly_code(OR);  break;
+	default: err("Unsupported operator '%s'\n", token_kind_text[op]);
+	}
+	return &int_type;
+}
+
+bool fold_binary(int code, int a, int b, int& v) // evaluate 'a <code> b' as the vm would, if well-defined
+{
+	unsigned int ua = a, ub = b; // wrap around, as the vm does
+	switch (code) {
+	case ADD: v = ua + ub; return true;
+	case SUB: v = ua - ub; return true;
+	case MUL: v = ua * ub; return true;
+	case DIV: if (b == 0 || (a == INT_MIN && b == -1)) return false; v = a / b; return true;
+	case MOD: if (b == 0 || (a == INT_MIN && b == -1)) return false; v = a % b; return true;
+	case SHL: if (b < 0 || b >= 32) return false; v = a >> b; return true; // same as SHL in run()
+	case SHR: if (b < 0 || b >= 32) return false; v = ua << b; return true; // same as SHR in run()
+	case AND: v = a & b; return true;
+	case OR:  v = a | b; return true;
+	case EQ:  v = a == b; return true;
+	case NE:  v = a != b; return true;
+	case GE:  v = a >= b; return true;
+	case GT:  v = a >  b; return true;
+	case LE:  v = a <= b; return true;
+	case LT:  v = a <  b; return true;
+	case LAND: v = a && b; return true;
+	case LOR:  v = a || b; return true;
+	}
+	return false;
+}
+
+void drop_code(size_t pos) // forget code generated from 'pos' on, to generate something else instead
+{
+	for (size_t i = pos; i < code_sec.size(); ++i) comments.erase(i);
+	code_sec.resize(pos);
+	next_display_instruction = min(next_display_instruction, pos);
+	auto it = offset.find(line_no);
+	if (it != offset.end()) {
+		it->second.first = min(it->second.first, pos);
+		it->second.second = min(it->second.second, pos);
+	}
+}
+
+void add_binary_code(instruction code, size_t a_start) // code for 'a <code> b', or a single MOV if both are constants
+{
+	// a constant operand is just 'MOV v', so code since a_start is exactly 'MOV a; PUSH; MOV b'
+	int v = 0;
+	if (a_start + 5 == code_sec.size() && code_sec[a_start] == MOV && code_sec[a_start + 2] == PUSH &&
+			code_sec[a_start + 3] == MOV && fold_binary(code, code_sec[a_start + 1], code_sec[a_start + 4], v)) {
+		drop_code(a_start);
+		add_assembly_code(MOV, v);
 	} else {
-		string name = "operator" + op_name + "(" + a_type + "," + b_type + ")";
-		auto it = symbols.find(name);
-		if (it == symbols.end()) {
-			err("Unknown function '%s'\n", name.c_str());
+		add_assembly_code(code);
+	}
+}
+
+const type_desc* number_type(const string& s) // 'double' or 'long long' for literals not fitting in an int
+{
+	bool hex = (s.size() > 1 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X'));
+	if (!hex && s.find_first_of(".eE") != string::npos) return &double_type;
+	if (s.find_first_of("lL") != string::npos || strtoull(s.c_str(), nullptr, 0) > INT_MAX) return &long_long_type;
+	return &int_type;
+}
+
+void add_wide_constant(const string& s, const type_desc* type) // push a wide literal, kept in data section
+{
+	vector<int> mem(2);
+	if (type == &double_type) wide_put<double>(mem.data(), strtod(s.c_str(), nullptr));
+	else wide_put<long long>(mem.data(), static_cast<long long>(strtoull(s.c_str(), nullptr, 0)));
+	size_t offset = add_const_string(alloc_name(), mem, type);
+	add_assembly_code(WGET, offset, s + "\t" + type->name);
+}
+
+void convert_code(const type_desc* from, const type_desc* to) // the value just computed, from type 'from' to 'to'
+{
+	bool a = is_wide_type(from), b = is_wide_type(to);
+	if (!a && !b) return;
+	if (!a) add_assembly_code(to == &double_type ? I2D : I2L, 0);
+	else if (!b) add_assembly_code(from == &double_type ? D2I : L2I);
+	else if (from != to) add_assembly_code(from == &double_type ? D2L : L2D, 0);
+}
+
+void discard_code(const type_desc* type) // drop the value of an expression statement
+{
+	if (is_wide_type(type)) add_assembly_code(ADJ, 2);
+}
+
+void condition_code(const type_desc* type) // test the value just computed against zero, into ax
+{
+	if (!is_wide_type(type)) return;
+	add_assembly_code(MOV, 0);
+	convert_code(&int_type, type);
+	add_assembly_code(type == &double_type ? DNE : LNE);
+}
+
+// 'a <op> b', with either one 'long long' or 'double': both are converted to the wider type,
+// the one below the top in place, and the int in ax pushed
+const type_desc* build_wide_code_for_op(const type_desc* a_type, token_kind op, const type_desc* b_type)
+{
+	const type_desc* t = (a_type == &double_type || b_type == &double_type ? &double_type : &long_long_type);
+	bool d = (t == &double_type);
+	if (!is_wide_type(a_type)) {
+		add_assembly_code(d ? I2D : I2L, 2);
+	} else if (a_type != t) {
+		add_assembly_code(L2D, 2);
+	}
+	convert_code(b_type, t);
+	instruction code = INVALID;
+	switch (op) {
+	case T_ADD: code = (d ? DADD : LADD); break;
+	case T_SUB: code = (d ? DSUB : LSUB); break;
+	case T_MUL: code = (d ? DMUL : LMUL); break;
+	case T_DIV: code = (d ? DDIV : LDIV); break;
+	case T_MOD: code = (d ? INVALID : LMOD); break;
+	case T_EQ:  code = (d ? DEQ : LEQ); break;
+	case T_NE:  code = (d ? DNE : LNE); break;
+	case T_GE:  code = (d ? DGE : LGE); break;
+	case T_GT:  code = (d ? DGT : LGT); break;
+	case T_LE:  code = (d ? DLE : LLE); break;
+	case T_LT:  code = (d ? DLT : LLT); break;
+	default: break;
+	}
+	if (code == INVALID) err("Unsupported operator '%s' on '%s'\n", token_kind_text[op], t->name.c_str());
+	add_assembly_code(code);
+	return (code >= LEQ && code <= LLT) || (code >= DEQ && code <= DLT) ? &int_type : t;
+}
+
+const type_desc* build_code_for_op(const type_desc* a_type, token_kind op, const type_desc* b_type, size_t a_start = SIZE_MAX)
+{
+	if (a_type == &int_type && b_type == &int_type) {
+		switch (op) {
+		case T_ADD: add_binary_code(ADD, a_start); break;
+		case T_SUB: add_binary_code(SUB, a_start); break;
+		case T_MUL: add_binary_code(MUL, a_start); break;
+		case T_DIV: add_binary_code(DIV, a_start); break;
+		case T_MOD: add_binary_code(MOD, a_start); break;
+		case T_SHL: add_binary_code(SHL, a_start); break;
+		case T_SHR: add_binary_code(SHR, a_start); break;
+		case T_AND: add_binary_code(AND, a_start); break;
+		case T_OR:  add_binary_code(OR, a_start); break;
+		case T_EQ:  add_binary_code(EQ, a_start); break;
+		case T_NE:  add_binary_code(NE, a_start); break;
+		case T_GE:  add_binary_code(GE, a_start); break;
+		case T_GT:  add_binary_code(GT, a_start); break;
+		case T_LE:  add_binary_code(LE, a_start); break;
+		case T_LT:  add_binary_code(LT, a_start); break;
+		case T_LAND: add_binary_code(LAND, a_start); break;
+		case T_LOR:  add_binary_code(LOR, a_start); break;
+		default: err("Unsupported operator '%s'\n", token_kind_text[op]);
 		}
-		auto [ is_code, offset, size, type_name, ret_type, arg_count ] = it->second;
-		if (!is_code) {
-			err("symbol '%s' is not a function!\n", name.c_str());
+		return &int_type;
+	} else if ((is_wide_type(a_type) || a_type == &int_type) && (is_wide_type(b_type) || b_type == &int_type)) {
+		return build_wide_code_for_op(a_type, op, b_type);
+	} else {
+		string name = "operator" + string(token_kind_text[op]);
+		string arg_types = a_type->name + "," + b_type->name;
+		const symbol_info* f = find_function(name, arg_types);
+		if (!f) {
+			err("Unknown function '%s(%s)'\n", name.c_str(), arg_types.c_str());
 		}
-		add_assembly_code(PUSH);
-		add_assembly_code(CALL, offset, ret_type + " " + name);
-		return ret_type;
+		if (!is_wide_type(b_type)) add_assembly_code(PUSH);
+		add_call_code(f->offset, f->ret_type->name + " " + name + "(" + arg_types + ")");
+		return f->ret_type;
 	}
 }
 
-string parse_expression(string stop_token = ";", int depth = 0, bool generate_code = true);
+const type_desc* parse_expression(token_kind stop_token = T_SEMICOLON, int depth = 0, bool generate_code = true);
 
-string parse_function(string name)
+const type_desc* parse_function(string name)
 {
 	log<3>("[DEBUG] %s: '%s'\n", __FUNCTION__, name.c_str());
 	next();
-	vector<string> arg_types;
-	if (token != ")") {
+	vector<const type_desc*> arg_types;
+	if (token_id != T_RPAREN) {
 		for (;;) {
-			string type = parse_expression(",");
+			const type_desc* type = parse_expression(T_COMMA);
 			arg_types.push_back(type);
-			add_assembly_code(PUSH);
-			if (token == ")") break;
-			expect_token(",", "function '" + name + "'");
+			if (!is_wide_type(type)) add_assembly_code(PUSH); // a wide one is on the stack already
+			if (token_id == T_RPAREN) break;
+			expect_token(T_COMMA, "function '" + name + "'");
 			next();
 		}
 	}
-	expect_token(")", "function '" + name + "'");
+	expect_token(T_RPAREN, "function '" + name + "'");
 	log<3>("[DEBUG] function '%s' has %zd args\n", name.c_str(), arg_types.size());
 	auto [ offset, ret_type, is_code, type_name, arg_count ] = query_function(name, arg_types);
+	int var_arg_words = 0; // as wide arguments take two
+	for (size_t i = (arg_count < 0 ? -arg_count : arg_types.size()); i < arg_types.size(); ++i) {
+		var_arg_words += (is_wide_type(arg_types[i]) ? 2 : 1);
+	}
 	if (arg_count < 0) {
-		add_assembly_code(MOV, arg_types.size() + arg_count, "variable parameter count");
+		add_assembly_code(MOV, var_arg_words, "variable parameter count");
 		add_assembly_code(PUSH);
 	}
-	add_assembly_code(CALL, offset, ret_type + " " + name + "(" + type_name + ")");
+	add_call_code(offset, ret_type->name + " " + name + "(" + type_name + ")");
 	if (arg_count < 0) {
-		add_assembly_code(ADJ, arg_types.size());
+		add_assembly_code(ADJ, -arg_count + var_arg_words);
 	}
-	log<3>("[DEBUG] ret_type = '%s'\n", ret_type.c_str());
+	if (is_wide_type(ret_type)) {
+		add_assembly_code(WGET, global_symbol("@return").offset, "@return\t" + ret_type->name);
+	}
+	log<3>("[DEBUG] ret_type = '%s'\n", ret_type->name.c_str());
 	next();
 	return ret_type;
 }
 
-string array_suffix(const vector<int>& dim)
-{
-	string s; for (auto e : dim) s += "[" + to_string(e) + "]"; return s;
-}
-
-int get_type_size(string type_name)
-{
-	if (type_name.substr(type_name.size() - 1) == "*") { // pointer
-		return sizeof(int); // we use 'int' as word size
-	} else {
-		return sizeof(int); // we use 'int' as default type
-	}
-}
-
-string parse_pointer_derefer(string name, string symbol_type_name,
+const type_desc* parse_pointer_derefer(string name, const type_desc* symbol_type,
 		int offset, bool is_global, bool generate_code, int depth)
 {
-	assert(symbol_type_name.substr(symbol_type_name.size() - 1) == "*");
-	string type_name = symbol_type_name;
+	const type_desc* t = symbol_type;
+	assert(t->kind == TYPE_POINTER);
 	if (is_global) {
-		if (generate_code) add_assembly_code(GET, offset, name + "\t" + type_name);
+		if (generate_code) add_assembly_code(GET, offset, name + "\t" + t->name);
 	} else {
-		if (generate_code) add_assembly_code(LGET, offset, name + "\t" + type_name);
+		if (generate_code) add_assembly_code(LGET, offset, name + "\t" + t->name);
 	}
 	for (size_t i = 0; ; ++i) {
 		if (generate_code) add_assembly_code(PUSH);
 		next();
-		parse_expression(";", depth, generate_code);
-		if (type_name.substr(type_name.size() - 1) != "*") {
+		parse_expression(T_SEMICOLON, depth, generate_code);
+		if (t->kind != TYPE_POINTER) {
 			err("too many level of dereferencing on a pointer!\n");
 		}
-		type_name = type_name.substr(0, type_name.size() - 1);
-		int element_size = get_type_size(type_name);
-		if (element_size != sizeof(int)) {
+		t = t->element;
+		if (t->size != 1) {
 			if (generate_code) add_assembly_code(PUSH);
-			if (generate_code) add_assembly_code(MOV, element_size / sizeof(int));
+			if (generate_code) add_assembly_code(MOV, t->size);
 			if (generate_code) add_assembly_code(MUL);
 		}
 		if (generate_code) add_assembly_code(ADD);
 		if (generate_code) add_assembly_code(PUSH);
 		if (generate_code) add_assembly_code(SGET);
-		expect_token("]", "[");
+		expect_token(T_RBRACKET, "[");
 		next();
-		if (token != "[") break;
+		if (token_id != T_LBRACKET) break;
 	}
-	return type_name;
+	return t;
 }
 
-string parse_array_element(string name, string symbol_type_name,
+const type_desc* parse_array_element(string name, const type_desc* symbol_type,
 		int offset, bool is_global, bool generate_code, int depth)
 {
-	assert(symbol_type_name.substr(symbol_type_name.size() - 1) == "]");
-	auto it = symbol_dim.find(name);
-	if (it == symbol_dim.end()) {
+	const type_desc* t = symbol_type;
+	if (t->kind != TYPE_ARRAY) {
 		err("symbol '%s' (type = '%s') is not an array!\n",
-				name.c_str(), symbol_type_name.c_str());
+				name.c_str(), t->name.c_str());
 	}
-	const auto& dim = it->second.second;
+	const auto& dim = t->dim;
+	const auto& stride = t->stride;
+	size_t start = code_sec.size();
 	if (is_global) {
-		if (generate_code) add_assembly_code(LEA, offset, name + "\t" + symbol_type_name);
+		if (generate_code) add_assembly_code(LEA, offset, name + "\t" + symbol_type->name);
 	} else {
-		if (generate_code) add_assembly_code(LLEA, offset, name + "\t" + symbol_type_name);
+		if (generate_code) add_assembly_code(LLEA, offset, name + "\t" + symbol_type->name);
 	}
 	if (generate_code) add_assembly_code(PUSH);
 	next();
+	size_t index_start = code_sec.size();
 	for (size_t i = 0; ; ++i) {
 		if (i > 0) {
 			if (generate_code) add_assembly_code(PUSH);
 			if (generate_code) add_assembly_code(MOV, dim[i]);
-			if (generate_code) add_assembly_code(MUL);
+			if (generate_code) add_binary_code(MUL, index_start);
+			if (generate_code) add_assembly_code(PUSH);
 		}
-		parse_expression(";", depth, generate_code);
+		index_start = code_sec.size();
+		parse_expression(T_SEMICOLON, depth, generate_code);
 		if (i > 0) {
 			if (generate_code) add_assembly_code(ADD);
 		}
-		expect_token("]", "[");
+		expect_token(T_RBRACKET, "[");
 		next();
-		if (token != "[") {
-			int factor = 1;
-			for (++i; i + 1 < dim.size(); ++i) {
-				factor *= dim[i];
-			}
-			if (factor > 1) {
+		t = t->element;
+		if (token_id != T_LBRACKET || i + 1 == dim.size()) {
+			if (stride[i] > 1) { // to words, as the index counts elements of this dimension
 				if (generate_code) add_assembly_code(PUSH);
-				if (generate_code) add_assembly_code(MOV, factor);
-				if (generate_code) add_assembly_code(MUL);
+				if (generate_code) add_assembly_code(MOV, stride[i]);
+				if (generate_code) add_binary_code(MUL, index_start);
 			}
 			break;
 		}
 		next();
 	}
-	if (generate_code) add_assembly_code(ADD);
-	if (generate_code) add_assembly_code(PUSH);
-	if (generate_code) add_assembly_code(SGET);
-	if (!symbol_type_name.empty()) {
-		if (symbol_type_name[symbol_type_name.size() - 1] == '*') {
-			symbol_type_name = symbol_type_name.substr(0, symbol_type_name.size() - 1);
-			while (!symbol_type_name.empty() && symbol_type_name[symbol_type_name.size() - 1] == ' ') {
-				symbol_type_name = symbol_type_name.substr(0, symbol_type_name.size() - 1);
-			}
+	bool partial = (t->kind == TYPE_ARRAY); // 'a[i]' of 'int a[3][4]' is a sub-array, so leave its address
+	if (generate_code && start + 5 == code_sec.size() && code_sec[start + 3] == MOV) { // 'LEA a; PUSH; MOV i', so a[i] is at a known place
+		int i = code_sec[start + 4];
+		drop_code(start);
+		add_assembly_code(partial ? (is_global ? LEA : LLEA) : (is_global ? GET : LGET),
+				offset + i, name + "[" + to_string(i) + "]\t" + symbol_type->name);
+	} else {
+		if (generate_code) add_assembly_code(ADD);
+		if (!partial) {
+			if (generate_code) add_assembly_code(PUSH);
+			if (generate_code) add_assembly_code(SGET);
 		}
 	}
-	return symbol_type_name;
+	return t;
 }
 
-string parse_expression(string stop_token, int depth, bool generate_code)
+const type_desc* parse_expression(token_kind stop_token, int depth, bool generate_code)
 {
 	log<3>("[DEBUG] >(%d) %s (stop at '%s', token = '%s'):\n",
-			depth, __FUNCTION__, stop_token.c_str(), token.c_str());
+			depth, __FUNCTION__, token_kind_text[stop_token], token.c_str());
 
+	size_t start = code_sec.size(); // of the code for this expression, which may be folded into one MOV
+	const type_desc* expr_type = &no_type;
 	if (type == number) {
-		int v = eval_number(token);
-		if (generate_code) add_assembly_code(MOV, v);
+		expr_type = number_type(token);
+		if (expr_type == &int_type) {
+			int v = eval_number(token);
+			if (generate_code) add_assembly_code(MOV, v);
+		} else {
+			if (generate_code) add_wide_constant(token, expr_type);
+		}
 		next();
-		return "int";
 	} else if (type == text) {
 		string v = eval_string(token);
 		auto mem = prepare_string(v);
 		string name = alloc_name();
-		string type_name = "const char*";
-		size_t offset = add_const_string(name, mem, type_name);
-		if (generate_code) add_assembly_code(MOV, offset, name + "\t" + type_name);
+		expr_type = type_of("const char*");
+		size_t offset = add_const_string(name, mem, expr_type);
+		if (generate_code) add_assembly_code(MOV, offset, name + "\t" + expr_type->name);
 		next();
-		return "const char*";
-	} else if (token == "sizeof") {
-		next(); expect_token("(", "sizeof");
-		next(); parse_expression(";", depth + 1, false);
-		expect_token(")", "sizeof");
-		int size = sizeof(int);
+	} else if (token_id == T_SIZEOF) {
+		next(); expect_token(T_LPAREN, "sizeof");
+		next(); const type_desc* t = parse_expression(T_SEMICOLON, depth + 1, false);
+		expect_token(T_RPAREN, "sizeof");
+		int size = t->size * sizeof(int);
 		if (generate_code) add_assembly_code(MOV, size);
-		next(); // TODO: support sizeof()
-		return "int";
-	} else if (token == "(") {
-		next();
-		string type_name = parse_expression(";", depth + 1, generate_code);
-		expect_token(")", "'(' in parse_expression");
+		next(); // TODO: support sizeof(type)
+		expr_type = &int_type;
+	} else if (token_id == T_LPAREN) {
 		next();
-		return type_name;
-	}
-
-	string type_name;
-	if (type != symbol) { // prefix
+		if (is_built_in_type()) { // cast
+			const type_desc* cast_type = type_of(parse_type_name());
+			expect_token(T_RPAREN, "cast");
+			next();
+			expr_type = parse_expression(T_NOT, depth + 1, generate_code);
+			if (generate_code) convert_code(expr_type, cast_type);
+			expr_type = cast_type;
+		} else {
+			expr_type = parse_expression(T_SEMICOLON, depth + 1, generate_code);
+			expect_token(T_RPAREN, "'(' in parse_expression");
+			next();
+		}
+	} else if (type != symbol) { // prefix
 		string op_name = token;
+		token_kind op = token_id;
 		next();
-		if (op_name == "++" || op_name == "--") {
+		if (op == T_INC || op == T_DEC) {
 			if (type != symbol) err("unexpected token ('%s') after '%s'!\n", token.c_str(), op_name.c_str());
 			string name = token;
-			auto [ is_global, offset, symbol_type_name, is_code ] = query_symbol(name);
-			if (symbol_type_name != "int") err("Operator '++' and '--' supports only 'int'!\n");
+			auto [ is_global, offset, symbol_type, is_code ] = query_symbol(name);
+			if (symbol_type != &int_type) err("Operator '++' and '--' supports only 'int'!\n");
 			if (is_global) {
-				if (generate_code) add_assembly_code(GET, offset, name + "\t" + symbol_type_name);
+				if (generate_code) add_assembly_code(GET, offset, name + "\t" + symbol_type->name);
 			} else {
-				if (generate_code) add_assembly_code(LGET, offset, name + "\t" + symbol_type_name);
+				if (generate_code) add_assembly_code(LGET, offset, name + "\t" + symbol_type->name);
 			}
-			if (op_name == "++") {
+			if (op == T_INC) {
 				if (generate_code) add_assembly_code(INC);
 			} else {
 				if (generate_code) add_assembly_code(DEC);
 			}
 			if (is_global) {
-				if (generate_code) add_assembly_code(PUT, offset, name + "\t" + symbol_type_name);
+				if (generate_code) add_assembly_code(PUT, offset, name + "\t" + symbol_type->name);
 			} else {
-				if (generate_code) add_assembly_code(LPUT, offset, name + "\t" + symbol_type_name);
+				if (generate_code) add_assembly_code(LPUT, offset, name + "\t" + symbol_type->name);
 			}
 			next();
-			type_name = "int";
+			expr_type = &int_type;
 		} else {
-			type_name = parse_expression(op_name, depth + 1, generate_code);
+			expr_type = parse_expression(op, depth + 1, generate_code);
 		}
 	} else {
 		string name = token;
 		next();
-		while (token == "::") {
+		while (token_id == T_SCOPE) {
 			name += token; next();
 			if (type != symbol) { err("unexpected token after '::'!\n"); }
 			name += token; next();
 		}
-		if (token == "(") {
-			type_name = parse_function(name);
-		} else if (token == "=") {
-			auto [ is_global, offset, symbol_type_name, is_code ] = query_symbol(name);
-			if (is_global) {
-				if (generate_code) add_assembly_code(LEA, offset, name + "\t" + type_name);
+		if (token_id == T_LPAREN) {
+			expr_type = parse_function(name);
+		} else if (token_id == T_ASSIGN) {
+			auto [ is_global, offset, symbol_type, is_code ] = query_symbol(name);
+			if (is_wide_type(symbol_type)) { // stored from the stack, where it is kept as the value
+				next();
+				const type_desc* b_type = parse_expression(T_COMMA, depth + 1, generate_code);
+				if (generate_code) convert_code(b_type, symbol_type);
+				if (generate_code) add_assembly_code(is_global ? WPUT : WLPUT, offset, name + "\t" + symbol_type->name);
 			} else {
-				if (generate_code) add_assembly_code(LLEA, offset, name + "\t" + type_name);
+				if (is_global) {
+					if (generate_code) add_assembly_code(LEA, offset, name + "\t" + expr_type->name);
+				} else {
+					if (generate_code) add_assembly_code(LLEA, offset, name + "\t" + expr_type->name);
+				}
+				if (generate_code) add_assembly_code(PUSH);
+				next();
+				const type_desc* b_type = parse_expression(T_COMMA, depth + 1, generate_code);
+				if (generate_code) convert_code(b_type, symbol_type);
+				if (generate_code) add_assembly_code(SPUT, offset, name + "\t" + expr_type->name);
 			}
-			if (generate_code) add_assembly_code(PUSH);
-			next();
-			parse_expression(",", depth + 1, generate_code);
-			if (generate_code) add_assembly_code(SPUT, offset, name + "\t" + type_name);
-			type_name = symbol_type_name;
-		} else if (token == "+=" || token == "-=" || token == "*=" || token == "/=" || token == "%=" ||
-				token == "<<=" || token == ">>=" || token == "&=" || token == "|=" || token == "&&=" || token == "||=") {
-			string op_name = token;
-			auto [ is_global, offset, symbol_type_name, is_code ] = query_symbol(name);
+			expr_type = symbol_type;
+		} else if (token_id == T_ADD_ASSIGN || token_id == T_SUB_ASSIGN || token_id == T_MUL_ASSIGN || token_id == T_DIV_ASSIGN || token_id == T_MOD_ASSIGN ||
+				token_id == T_SHL_ASSIGN || token_id == T_SHR_ASSIGN || token_id == T_AND_ASSIGN || token_id == T_OR_ASSIGN) {
+			token_kind op = token_id;
+			auto [ is_global, offset, symbol_type, is_code ] = query_symbol(name);
+			if (is_wide_type(symbol_type)) err("Operator '%s' on '%s' is not supported yet!\n", token.c_str(), symbol_type->name.c_str());
 			if (is_global) {
-				if (generate_code) add_assembly_code(LEA, offset, name + "\t" + type_name);
+				if (generate_code) add_assembly_code(LEA, offset, name + "\t" + expr_type->name);
 			} else {
-				if (generate_code) add_assembly_code(LLEA, offset, name + "\t" + type_name);
+				if (generate_code) add_assembly_code(LLEA, offset, name + "\t" + expr_type->name);
 			}
 			if (generate_code) add_assembly_code(PUSH);
 			next();
-			string b_type = parse_expression(",", depth + 1, generate_code);
-			if (generate_code) add_assembly_code(SPUT, offset, name + "\t" + type_name);
-			type_name = build_code_for_op2(symbol_type_name, op_name, b_type);
+			parse_expression(T_COMMA, depth + 1, generate_code);
+			if (generate_code) add_assembly_code(SPUT, offset, name + "\t" + expr_type->name);
+			expr_type = build_code_for_op2(op);
 			if (is_global) {
-				if (generate_code) add_assembly_code(PUT, offset, name + "\t" + type_name);
+				if (generate_code) add_assembly_code(PUT, offset, name + "\t" + expr_type->name);
 			} else {
-				if (generate_code) add_assembly_code(LPUT, offset, name + "\t" + type_name);
+				if (generate_code) add_assembly_code(LPUT, offset, name + "\t" + expr_type->name);
 			}
-		} else if (token == "++" || token == "--") { // suffix/postfix
-			auto [ is_global, offset, symbol_type_name, is_code ] = query_symbol(name);
+		} else if (token_id == T_INC || token_id == T_DEC) { // suffix/postfix
+			auto [ is_global, offset, symbol_type, is_code ] = query_symbol(name);
+			if (is_wide_type(symbol_type)) err("Operator '++' and '--' supports only 'int'!\n");
 			if (is_global) {
-				if (generate_code) add_assembly_code(GET, offset, name + "\t" + type_name);
+				if (generate_code) add_assembly_code(GET, offset, name + "\t" + expr_type->name);
 			} else {
-				if (generate_code) add_assembly_code(LGET, offset, name + "\t" + type_name);
+				if (generate_code) add_assembly_code(LGET, offset, name + "\t" + expr_type->name);
 			}
 			if (generate_code) add_assembly_code(PUSH);
-			if (token == "++") {
+			if (token_id == T_INC) {
 				if (generate_code) add_assembly_code(INC);
 			} else {
 				if (generate_code) add_assembly_code(DEC);
 			}
 			if (is_global) {
-				if (generate_code) add_assembly_code(PUT, offset, name + "\t" + type_name);
+				if (generate_code) add_assembly_code(PUT, offset, name + "\t" + expr_type->name);
 			} else {
-				if (generate_code) add_assembly_code(LPUT, offset, name + "\t" + type_name);
+				if (generate_code) add_assembly_code(LPUT, offset, name + "\t" + expr_type->name);
 			}
 			if (generate_code) add_assembly_code(POP);
 			next();
-			type_name = symbol_type_name;
-		} else if (token == "{") {
+			expr_type = symbol_type;
+		} else if (token_id == T_LBRACE) {
 			// TODO: initializer
-			skip_until("}", "");
-		} else if (token == "[") {
-			auto [ is_global, offset, symbol_type_name, is_code ] = query_symbol(name);
-			log<3>("symbol_type_name: '%s'\n", symbol_type_name.c_str());
-			if (symbol_type_name.substr(symbol_type_name.size() - 1) == "*") {
-				type_name = parse_pointer_derefer(name, symbol_type_name,
+			skip_until(T_RBRACE, "");
+		} else if (token_id == T_LBRACKET) {
+			auto [ is_global, offset, symbol_type, is_code ] = query_symbol(name);
+			log<3>("symbol_type: '%s'\n", symbol_type->name.c_str());
+			if (symbol_type->kind == TYPE_POINTER) {
+				expr_type = parse_pointer_derefer(name, symbol_type,
 						offset, is_global, generate_code, depth + 1);
 			} else {
-				type_name = parse_array_element(name, symbol_type_name,
+				expr_type = parse_array_element(name, symbol_type,
 						offset, is_global, generate_code, depth + 1);
 			}
-		} else if (token == "." || token == "->") {
+		} else if (token_id == T_DOT || token_id == T_ARROW) {
 			// TODO: find member
 			next();
-		} else if (token == ".*" || token == "->*") {
+		} else if (token_id == T_DOT_STAR || token_id == T_ARROW_STAR) {
 			// TODO: find member
 			next();
 		} else {
@@ -971,48 +1813,46 @@ string parse_expression(string stop_token, int depth, bool generate_code)
 			if (it != enum_types.end()) {
 				int value = it->second.second;
 				if (generate_code) add_assembly_code(MOV, value);
-				type_name = "int";
+				expr_type = &int_type;
 			} else {
-				auto [ is_global, offset, symbol_type_name, is_code ] = query_symbol(name);
-				if (is_global) {
-					if (symbol_type_name == "int") {
-						if (generate_code) add_assembly_code(GET, offset, name + "\t" + symbol_type_name);
+				auto [ is_global, offset, symbol_type, is_code ] = query_symbol(name);
+				if (is_wide_type(symbol_type) && !is_code) {
+					if (generate_code) add_assembly_code(is_global ? WGET : WLGET, offset, name + "\t" + symbol_type->name);
+				} else if (is_global) {
+					if (symbol_type == &int_type) {
+						if (generate_code) add_assembly_code(GET, offset, name + "\t" + symbol_type->name);
 					} else {
-						if (generate_code) add_assembly_code(LEA, offset, name + "\t" + symbol_type_name);
+						if (generate_code) add_assembly_code(LEA, offset, name + "\t" + symbol_type->name);
 					}
 				} else {
-					if (symbol_type_name == "int") {
-						if (generate_code) add_assembly_code(LGET, offset, name + "\t" + symbol_type_name);
+					if (symbol_type == &int_type) {
+						if (generate_code) add_assembly_code(LGET, offset, name + "\t" + symbol_type->name);
 					} else {
-						if (generate_code) add_assembly_code(LLEA, offset, name + "\t" + symbol_type_name);
+						if (generate_code) add_assembly_code(LLEA, offset, name + "\t" + symbol_type->name);
 					}
 				}
-				if (is_code) {
-					type_name = "(*)(" + symbol_type_name + ")";
-				} else {
-					type_name = symbol_type_name;
-				}
+				expr_type = symbol_type; // of a function, its address
 			}
 		}
 	}
 
-	while (precedence(token) < precedence(stop_token)) {
-		string op_name = token;
+	while (precedence(token_id, token) < precedence(stop_token, token_kind_text[stop_token])) {
+		token_kind op = token_id;
 		next();
-		if (generate_code) add_assembly_code(PUSH);
-		string b_type = parse_expression(op_name, depth + 1, generate_code);
-		type_name = build_code_for_op(type_name, op_name, b_type);
+		if (generate_code && !is_wide_type(expr_type)) add_assembly_code(PUSH);
+		const type_desc* b_type = parse_expression(op, depth + 1, generate_code);
+		expr_type = build_code_for_op(expr_type, op, b_type, start);
 	}
 
 	log<3>("[DEBUG] >(%d) %s (stop at '%s', token = '%s') return '%s'\n",
-			depth, __FUNCTION__, stop_token.c_str(), token.c_str(), type_name.c_str());
-	return type_name;
+			depth, __FUNCTION__, token_kind_text[stop_token], token.c_str(), expr_type->name.c_str());
+	return expr_type;
 }
 
 void parse_init_value(vector<int>& dim, vector<int>& dim2, vector<int>& cursor,
 		vector<pair<vector<int>, int>>& init)
 {
-	if (token == "{") {
+	if (token_id == T_LBRACE) {
 		if (cursor.size() >= dim.size()) err("too many level in init val!\n");
 		next();
 		size_t i = cursor.size();
@@ -1023,15 +1863,15 @@ void parse_init_value(vector<int>& dim, vector<int>& dim2, vector<int>& cursor,
 				if (cursor[i] >= dim[i]) err("array init overflow!\n");
 			}
 			parse_init_value(dim, dim2, cursor, init);
-			if (token == "}") break;
-			expect_token(",", "init-value");
+			if (token_id == T_RBRACE) break;
+			expect_token(T_COMMA, "init-value");
 			next();
 		}
 		cursor.pop_back();
-		expect_token("}", "init-value");
+		expect_token(T_RBRACE, "init-value");
 		next();
 	} else {
-		//parse_expression(",");
+		//parse_expression(T_COMMA);
 		int v = eval_number(token);
 		next();
 		init.push_back(make_pair(cursor, v));
@@ -1043,64 +1883,69 @@ void parse_declare()
 	string type_name = parse_type_name();
 	string type_prefix = type_name;
 	string name = token; next();
-	if (token == "(") { // function
+	if (token_id == T_LPAREN) { // function
 		log<3>("[DEBUG] => function '%s', type='%s'\n", name.c_str(), type_name.c_str());
 		if (!scopes.empty() && scopes.back().first != "function") {
 			err("nesting function is not allowed!\n");
 		}
 		next();
 		vector<pair<string, string>> args; // [ { type, name } ]
-		if (token != ")") {
+		if (token_id != T_RPAREN) {
 			for (;;) {
 				string arg_type_name = parse_type_name();
 				string arg_name = token; next();
 				args.push_back(make_pair(arg_type_name, arg_name));
-				if (token != ",") break;
+				if (token_id != T_COMMA) break;
 				next();
 			}
 		}
-		expect_token(")", "function " + name);
+		expect_token(T_RPAREN, "function " + name);
 		string args_type = "(";
 		for (size_t i = 0; i < args.size(); ++i) {
 			args_type += (i == 0 ? "" : ",") + args[i].first;
 		}
 		args_type += ")";
-		add_code_symbol(name, args_type, type_name, args.size());
+		int arg_words = 0; // as wide arguments take two
+		for (auto& e : args) arg_words += (is_wide_type(type_of(e.first)) ? 2 : 1);
+		add_code_symbol(name, args_type, type_name, arg_words);
 		scopes.push_back(make_pair("function", name));
-		current_function = make_tuple(name, args_type, type_name, args.size());
+		current_function = make_tuple(name, args_type, type_name, arg_words);
 		next();
-		expect_token("{", "function '" + name + "', '" + name + type_name + "'");
+		expect_token(T_LBRACE, "function '" + name + "', '" + name + type_name + "'");
 		size_t offset = add_assembly_code(ENTER);
-		stack_frame_table.push_back(make_pair(offset + 1, unordered_map<string, tuple<int, int, string>>()));
-		for (size_t i = 0; i < args.size(); ++i) {
-			add_argument(args[i].second, args[i].first, args.size() - i + 1);
+		stack_frame_table.push_back(make_pair(offset + 1, vector<int>()));
+		for (size_t i = 0, words = arg_words; i < args.size(); ++i) { // the last one is right above the return address
+			const type_desc* t = type_of(args[i].first);
+			words -= (is_wide_type(t) ? 2 : 1);
+			add_argument(args[i].second, t, words + 2);
 		}
 	} else { // variable
 		log<3>("[DEBUG] => variable '%s', type='%s'\n", name.c_str(), type_name.c_str());
 		for (;;) {
-			if (token == "[") {
+			if (token_id == T_LBRACKET) {
 				next();
 				vector<int> dim;
 				for (;;) {
 					int size = 0; // size undetermined
-					if (token != "]") {
+					if (token_id != T_RBRACKET) {
 						if (type != number) err("invalid array size '%s'! it should be a number.\n", token.c_str());
 						size = eval_number(token);
 						if (size <= 0) err("invalid array size '%s'! it should be a positive integer!\n", token.c_str());
 						next();
-						expect_token("]", "array");
+						expect_token(T_RBRACKET, "array");
 						next();
 					}
 					dim.push_back(size);
-					if (token != "[") break;
+					if (token_id != T_LBRACKET) break;
 					next();
 				}
 				int size = 1; for (auto d : dim) size *= d;
+				if (is_wide_type(type_of(type_name))) err("arrays of '%s' are not supported yet!\n", type_name.c_str());
 				if (verbose >= 3) {
 					log("array dim = ["); for (size_t i = 0; i < dim.size(); ++i) log("%s%d", (i > 0 ? "," : ""), dim[i]); log("]\n");
 				}
-				if (!size && token != "=") err("missing array size!\n");
-				if (token == "=") {
+				if (!size && token_id != T_ASSIGN) err("missing array size!\n");
+				if (token_id == T_ASSIGN) {
 					next();
 					vector<int> dim2 = dim;
 					vector<int> cursor;
@@ -1115,10 +1960,11 @@ void parse_declare()
 							log("] = %d\n", init[i].second);
 						}
 					}
-					size = 1; for (auto d : dim2) size *= d;
-					assert(size > 0);
 					type_name += array_suffix(dim2);
-					auto [ is_global, offset ] = add_variable(name, size, type_name);
+					const type_desc* t = type_of(type_name);
+					size = t->size;
+					assert(size > 0);
+					auto [ is_global, offset ] = add_variable(name, size, t);
 					unordered_map<int, pair<string, int>> index_to_val;
 					for (size_t i = 0; i < init.size(); ++i) {
 						const auto& cursor = init[i].first;
@@ -1147,34 +1993,39 @@ void parse_declare()
 							add_assembly_code(LPUT, offset + i, it->second.first);
 						}
 					}
-					symbol_dim.insert(make_pair(name, make_pair(size, dim2)));
 				} else {
 					type_name += array_suffix(dim);
-					add_variable(name, size, type_name);
+					const type_desc* t = type_of(type_name);
+					add_variable(name, t->size, t);
 				}
 			} else {
-				auto [ is_global, offset ] = add_variable(name, 1, type_name); // TODO: support non-int type
-				if (token == "=") {
+				const type_desc* t = type_of(type_name);
+				bool wide = is_wide_type(t);
+				auto [ is_global, offset ] = add_variable(name, t->size, t);
+				if (token_id == T_ASSIGN) {
 					next();
-					parse_expression(",");
-					if (is_global) {
+					convert_code(parse_expression(T_COMMA), t);
+					if (wide) {
+						add_assembly_code(is_global ? WPUT : WLPUT, offset, name + "\t" + type_name);
+						add_assembly_code(ADJ, 2);
+					} else if (is_global) {
 						add_assembly_code(PUT, offset, name + "\t" + type_name);
 					} else {
 						add_assembly_code(LPUT, offset, name + "\t" + type_name);
 					}
 				}
 			}
-			if (token != ",") break;
+			if (token_id != T_COMMA) break;
 			next();
 			type_name = type_prefix;
-			while (token == "*" || token == "&") {
+			while (token_id == T_MUL || token_id == T_AND) {
 				type_name += token;
 				next();
 			}
 			name = token; next();
 			log<3>("[DEBUG] => another variable '%s', type='%s'\n", name.c_str(), type_name.c_str());
 		}
-		expect_token(";", "variable");
+		expect_token(T_SEMICOLON, "variable");
 	}
 }
 
@@ -1182,30 +2033,30 @@ void parse_init_statement()
 {
 	log<3>("[DEBUG] > %s:\n", __FUNCTION__);
 
-	if (token == "auto" || token == "const" || token == "static" ||
-				token == "extern" || is_built_in_type()) { // start as type
+	if (token_id == T_AUTO || token_id == T_CONST || token_id == T_STATIC ||
+				token_id == T_EXTERN || is_built_in_type()) { // start as type
 		parse_declare();
 	} else {
-		parse_expression();
-		expect_token(";", "statement");
+		discard_code(parse_expression());
+		expect_token(T_SEMICOLON, "statement");
 	}
 }
 
 void parse_statements(int depth = 0)
 {
 	log<3>("[DEBUG] >(%d) %s: (token = '%s')\n", depth, __FUNCTION__, token.c_str());
-	if (token == "{") {
+	if (token_id == T_LBRACE) {
 		log<3>("[DEBUG] =>(%d) statement '{'\n", depth);
-		next(); while (!token.empty() && token != "}") parse_statements(depth + 1);
-		expect_token("}", "{");
+		next(); while (!token.empty() && token_id != T_RBRACE) parse_statements(depth + 1);
+		expect_token(T_RBRACE, "{");
 		next();
-	} else if (token == "if") {
+	} else if (token_id == T_IF) {
 		log<3>("[DEBUG] =>(%d) statement 'if'\n", depth);
-		next(); expect_token("(", "if");
-		next(); parse_expression(); expect_token(")", "if");
+		next(); expect_token(T_LPAREN, "if");
+		next(); condition_code(parse_expression()); expect_token(T_RPAREN, "if");
 		size_t code_offset_1 = add_assembly_code(JZ, code_sec.size() + 2);
 		next(); parse_statements(depth + 1);
-		if (token == "else") {
+		if (token_id == T_ELSE) {
 			size_t code_offset_2 = add_assembly_code(JMP, code_sec.size() + 2);
 			update_relative_address_here(code_offset_1);
 			next();
@@ -1214,60 +2065,66 @@ void parse_statements(int depth = 0)
 		} else {
 			update_relative_address_here(code_offset_1);
 		}
-	} else if (token == "for") {
+	} else if (token_id == T_FOR) {
 		log<3>("[DEBUG] =>(%d) statement 'for'\n", depth);
-		next(); expect_token("(", "for");
-		next(); parse_init_statement(); expect_token(";", "for");
+		next(); expect_token(T_LPAREN, "for");
+		next(); parse_init_statement(); expect_token(T_SEMICOLON, "for");
 		size_t code_offset_1 = code_sec.size();
-		next(); parse_expression(); expect_token(";", "for");
+		next(); condition_code(parse_expression()); expect_token(T_SEMICOLON, "for");
 		size_t code_offset_2 = add_assembly_code(JZ, code_sec.size() + 2);
 		size_t code_offset_3 = add_assembly_code(JMP, code_sec.size() + 2);
 		size_t code_offset_4 = code_sec.size();
-		next(); parse_expression(); expect_token(")", "for");
+		next(); discard_code(parse_expression()); expect_token(T_RPAREN, "for");
 		add_assembly_code(JMP, code_offset_1);
 		update_relative_address_here(code_offset_3);
-		expect_token(")", "for");
+		expect_token(T_RPAREN, "for");
 		next(); parse_statements(depth + 1);
 		add_assembly_code(JMP, code_offset_4);
 		update_relative_address_here(code_offset_2);
-	} else if (token == "while") {
+	} else if (token_id == T_WHILE) {
 		log<3>("[DEBUG] =>(%d) statement 'while'\n", depth);
-		next(); expect_token("(", "while");
+		next(); expect_token(T_LPAREN, "while");
 		size_t code_offset_1 = code_sec.size();
-		next(); parse_expression(); expect_token(")", "while");
+		next(); condition_code(parse_expression()); expect_token(T_RPAREN, "while");
 		size_t code_offset_2 = add_assembly_code(JZ, code_sec.size() + 2);
 		next(); parse_statements(depth + 1);
 		add_assembly_code(JMP, code_offset_1);
 		update_relative_address_here(code_offset_2);
-	} else if (token == "do") {
+	} else if (token_id == T_DO) {
 		log<3>("[DEBUG] =>(%d) statement 'do'\n", depth);
-		next(); expect_token("{", "do");
+		next(); expect_token(T_LBRACE, "do");
 		size_t code_offset_1 = code_sec.size();
 		parse_statements(depth + 1);
-		expect_token("while", "do");
-		next(); expect_token("(", "do");
-		next(); parse_expression();
+		expect_token(T_WHILE, "do");
+		next(); expect_token(T_LPAREN, "do");
+		next(); condition_code(parse_expression());
 		add_assembly_code(JNZ, code_offset_1);
-		expect_token(")", "do");
-		next(); expect_token(";", "do");
-	} else if (token == "return") {
+		expect_token(T_RPAREN, "do");
+		next(); expect_token(T_SEMICOLON, "do");
+	} else if (token_id == T_RETURN) {
 		log<3>("[DEBUG] =>(%d) statement 'return'\n", depth);
 		next();
 		if (scopes.empty() || scopes.back().first != "function") {
 			err("unexpected 'return' statement!\n");
 		}
 		string name = scopes.back().second;
-		if (token != ";") {
-			parse_expression();
+		if (token_id != T_SEMICOLON) {
+			const type_desc* ret_type = type_of(get<2>(current_function));
+			convert_code(parse_expression(), ret_type);
+			if (is_wide_type(ret_type)) { // returned through a global, as ax is not wide enough
+				add_assembly_code(WPUT, global_symbol("@return").offset, "@return\t" + ret_type->name);
+			}
+		}
+		expect_token(T_SEMICOLON, "return");
+		if (!add_tail_call()) {
+			add_assembly_code(LEAVE);
+			add_assembly_code(RET, get<3>(current_function));
 		}
-		expect_token(";", "return");
-		add_assembly_code(LEAVE);
-		add_assembly_code(RET, get<3>(current_function));
 		next();
 		returned_functions.insert(get<0>(current_function));
-	} else if (token == "typedef") {
+	} else if (token_id == T_TYPEDEF) {
 		log<3>("[DEBUG] =>(%d) statement 'typedef'\n", depth);
-		skip_until(";", "typedef");
+		skip_until(T_SEMICOLON, "typedef");
 		next();
 	} else {
 		log<3>("[DEBUG] =>(%d) init-statement\n", depth);
@@ -1287,11 +2144,11 @@ void parse_enum()
 	string name = token;
 	next(); // skip name
 
-	expect_token("{", "enum " + name);
+	expect_token(T_LBRACE, "enum " + name);
 	next(); // skip '{'
 
 	int value = 0;
-	while (!token.empty() && token != "}") {
+	while (!token.empty() && token_id != T_RBRACE) {
 		if (type != symbol) {
 			err("invalid token '%s' for 'enum' value!\n", token.c_str());
 		}
@@ -1299,7 +2156,7 @@ void parse_enum()
 		next(); // skip
 
 		string value_txt;
-		if (token == "=") {
+		if (token_id == T_ASSIGN) {
 			next(); // skip '='
 			if (type != symbol && type != number) {
 				err("invalid token '%s' for 'enum' declearation!\n", token.c_str());
@@ -1327,13 +2184,13 @@ void parse_enum()
 		}
 		enum_types.insert(make_pair(enum_key, make_pair(name, value)));
 
-		if (token == "}") break;
-		expect_token(",", "enum " + name);
+		if (token_id == T_RBRACE) break;
+		expect_token(T_COMMA, "enum " + name);
 		next();
 	}
-	expect_token("}", "enum " + name);
+	expect_token(T_RBRACE, "enum " + name);
 	next(); // skip '}'
-	expect_token(";", "enum " + name);
+	expect_token(T_SEMICOLON, "enum " + name);
 	next(); // skip ';'
 	log<3>("[DEBUG] end of enum %s\n", name.c_str());
 	if (verbose >= 4) dump_enum();
@@ -1341,40 +2198,156 @@ void parse_enum()
 
 bool load(string filename)
 {
-	ifstream file(filename);
-	if (!file.is_open()) {
+	if (!src.load(filename)) {
 		err("failed to open file '%s'!\n", filename.c_str());
 		return false;
 	}
-	string line;
-	while (getline(file, line)) {
-		src.push_back(line);
-	}
-	file.close();
 	return true;
 }
 
+int lex_only(const string& filename) // '--lex-only': tokenize the source (again and again), and report the throughput
+{
+	if (!load(filename)) return 1;
+	size_t bytes = src.bytes;
+	size_t tokens = 0, rounds = 0;
+	double seconds = 0;
+	auto start = chrono::steady_clock::now();
+	do {
+		line_no = 0; p = line_end = nullptr;
+		for (next(); !token.empty(); next()) ++tokens;
+		++rounds;
+		seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	} while (seconds < 0.5);
+	log("%zd token(s), %zd byte(s), %zd round(s) in %.3f s: %.1f MB/s\n",
+			tokens / rounds, bytes, rounds, seconds, bytes * rounds / seconds / 1e6);
+	return 0;
+}
+
+//--------------------------------------------------------//
+// native functions
+
+ostream& native_stream(int a)
+{
+	if (a < 0 || a >= static_cast<int>(native_streams.size()) || !native_streams[a]) {
+		err("Unsupported operator<< for %d\n", a);
+		exit(1);
+	}
+	return *native_streams[a];
+}
+
+int native_ostream_int(int sp) // operator<<(ostream,int)
+{
+	int b = m[sp];
+	int a = m[sp + 1];
+	log<3>("[DEBUG] args: %d, %d\n", a, b);
+	native_stream(a) << b;
+	return a;
+}
+
+int native_ostream_string(int sp) // operator<<(ostream,const char*)
+{
+	int b = m[sp];
+	int a = m[sp + 1];
+	log<3>("[DEBUG] args: %d, %d\n", a, b);
+	native_stream(a) << reinterpret_cast<const char*>(&m[b]);
+	return a;
+}
+
+int native_ostream_endl(int sp) // operator<<(ostream,(*)(endl_t))
+{
+	int b = m[sp];
+	int a = m[sp + 1];
+	log<3>("[DEBUG] args: %d, %d\n", a, b);
+	native_stream(a) << endl;
+	return a;
+}
+
+int native_ostream_double(int sp) // operator<<(ostream,double)
+{
+	double b = wide_get<double>(&m[sp]);
+	int a = m[sp + 2];
+	log<3>("[DEBUG] args: %d, %g\n", a, b);
+	native_stream(a) << b;
+	return a;
+}
+
+int native_ostream_long_long(int sp) // operator<<(ostream,long long)
+{
+	long long b = wide_get<long long>(&m[sp]);
+	int a = m[sp + 2];
+	log<3>("[DEBUG] args: %d, %lld\n", a, b);
+	native_stream(a) << b;
+	return a;
+}
+
+int native_printf(int sp) // printf(const char*,...)
+{
+	ostream& out = *vm.cout_stream;
+	int var_arg_count = m[sp];
+	int var_arg_start = sp + var_arg_count;
+	const char* fmt = reinterpret_cast<const char*>(&m[m[var_arg_start + 1]]);
+	int n = 0;
+	char buf[400]; // enough for any '%f'
+	auto put = [&](const char* s, int len) { out.write(s, len); n += len; };
+	auto put_buf = [&](int len) { put(buf, min(len, static_cast<int>(sizeof(buf)) - 1)); };
+	for (int i = 0; *fmt; ++fmt) {
+		if (*fmt == '%') {
+			string spec = "%"; // flags, width and precision, as in '%.2f'
+			while (fmt[1] && strchr("-+ #0123456789.", fmt[1])) spec += *++fmt;
+			bool wide = false; // 'long' or 'long long', both as 'long long'
+			while (fmt[1] == 'l') { wide = true; ++fmt; }
+			char c = *++fmt;
+			if (!c) break;
+			if (c == 'f' || c == 'g' || c == 'e' || ((c == 'd' || c == 'i') && wide)) { // wide arguments
+				if (i + 1 >= var_arg_count) { put("<missing>", 9); i += 2; continue; }
+				const int* p = &m[var_arg_start - i - 1];
+				i += 2;
+				if (c == 'd' || c == 'i') put_buf(snprintf(buf, sizeof(buf), (spec + "lld").c_str(), wide_get<long long>(p)));
+				else put_buf(snprintf(buf, sizeof(buf), (spec + c).c_str(), wide_get<double>(p)));
+			} else if (c == 'd' || c == 'i' || c == 'c' || c == 's' || c == 'p') {
+				if (i >= var_arg_count) { put("<missing>", 9); ++i; continue; }
+				int v = m[var_arg_start - i++];
+				const char* s = (c == 's' || c == 'p') ? reinterpret_cast<const char*>(&m[v]) : nullptr;
+				if (c == 'd' || c == 'i') { put_buf(snprintf(buf, sizeof(buf), (spec + "d").c_str(), v)); }
+				else if (c == 'c') { buf[0] = static_cast<char>(v); put(buf, 1); }
+				else if (c == 's') { put(s, strlen(s)); }
+				else { put_buf(snprintf(buf, sizeof(buf), "%p", s)); }
+			} else {
+				put(&c, 1);
+			}
+		} else {
+			put(fmt, 1);
+		}
+	}
+	return n;
+}
+
 void init_symbol()
 {
 	log<3>("[DEBUG] prepare external symbols\n");
 	add_external_symbol("cout", "ostream");
 	add_external_symbol("cerr", "ostream");
 	add_external_symbol("endl", "endl_t", "void", 1);
-	add_external_symbol("operator<<", "ostream,int", "ostream", 2);
-	add_external_symbol("operator<<", "ostream,double", "ostream", 2);
-	add_external_symbol("operator<<", "ostream,const char*", "ostream", 2);
-	add_external_symbol("operator<<", "ostream,(*)(endl_t)", "ostream", 2);
-	add_external_symbol("printf", "const char*,...", "int", -1);
-	log<3>("[DEBUG] total %zd symbols are prepared\n", symbols.size());
+	add_external_symbol("operator<<", "ostream,int", "ostream", 2, native_ostream_int);
+	add_external_symbol("operator<<", "ostream,double", "ostream", 3, native_ostream_double);
+	add_external_symbol("operator<<", "ostream,long long", "ostream", 3, native_ostream_long_long);
+	add_external_symbol("operator<<", "ostream,const char*", "ostream", 2, native_ostream_string);
+	add_external_symbol("operator<<", "ostream,(*)(endl_t)", "ostream", 2, native_ostream_endl);
+	add_external_symbol("printf", "const char*,...", "int", -1, native_printf);
+	add_variable("@return", 2, &long_long_type); // returned 'long long' or 'double', as ax is too narrow
+	log<3>("[DEBUG] total %zd symbols are prepared\n", symbol_ids.size());
 	external_data_size = data_sec.size();
 	external_code_size = code_sec.size();
+	native_streams.assign(external_data_size, nullptr);
+	native_streams[global_symbol("cout").offset] = vm.cout_stream;
+	native_streams[global_symbol("cerr").offset] = vm.cerr_stream;
 	if (verbose >= 3) {
 		size_t i = 0;
-		for (auto it = symbols.begin(); it != symbols.end(); ++it) {
-			auto name = it->first;
-			auto [ is_code, offset, size, type_name, ret_type, arg_count ] = it->second;
+		for (const auto& e : symbols) {
+			if (e.bindings.empty()) continue;
+			auto [ is_code, offset, size, type_name, ret_type, arg_count, depth ] = e.bindings.front();
 			log("[DEBUG] [%zd] '%s': %s, offset=%zd, size=%zd, type='%s', ret_type='%s', arg_count=%d\n",
-					i++, name.c_str(), (is_code ? "code" : "data"), offset, size, type_name.c_str(), ret_type.c_str(), arg_count);
+					i++, e.name.c_str(), (is_code ? "code" : "data"), offset, size, type_name->name.c_str(), ret_type->name.c_str(), arg_count);
 		}
 	}
 }
@@ -1384,34 +2357,34 @@ void parse()
 	init_symbol();
 
 	for (next(); !token.empty();) {
-		if (token == "using") {
-			next(); while (!token.empty() && token != ";") next();
+		if (token_id == T_USING) {
+			next(); while (!token.empty() && token_id != T_SEMICOLON) next();
 			if (token.empty()) { err("missing ';' for 'using'!\n"); }
 			log<3>("[DEBUG] => 'using' statement skipped\n");
 			next();
-		} else if (token == "typedef") {
-			skip_until(";", token);
+		} else if (token_id == T_TYPEDEF) {
+			skip_until(T_SEMICOLON, token);
 			log<3>("[DEBUG] => 'typedef' statement skipped\n");
 			next();
-		} else if (token == "enum") {
+		} else if (token_id == T_ENUM) {
 			parse_enum();
-		} else if (token == "union" || token == "struct" || token == "class" || token == "namespace") {
+		} else if (token_id == T_UNION || token_id == T_STRUCT || token_id == T_CLASS || token_id == T_NAMESPACE) {
 			string keyword = token;
 			next();
 			string name = token;
 			next();
-			expect_token("{", keyword + " " + name);
+			expect_token(T_LBRACE, keyword + " " + name);
 			scopes.push_back(make_pair(keyword, name));
 			log<3>("[DEBUG] => (%s %s) start\n", keyword.c_str(), name.c_str());
 			next();
-		} else if (token == "template") {
-			skip_until(";", token);
+		} else if (token_id == T_TEMPLATE) {
+			skip_until(T_SEMICOLON, token);
 			log<3>("[DEBUG] => 'template' statement skipped\n");
 			next();
-		} else if (token == ";") {
+		} else if (token_id == T_SEMICOLON) {
 			log<3>("[DEBUG] => ';' - end of statement\n");
 			next();
-		} else if (token == "}") {
+		} else if (token_id == T_RBRACE) {
 			string scope_type;
 			string scope_name;
 			if (!scopes.empty()) {
@@ -1426,7 +2399,7 @@ void parse()
 					add_assembly_code(RET, get<3>(current_function));
 				}
 				current_function = make_tuple("", "", "", 0);
-				stack_frame_table.pop_back();
+				leave_stack_frame();
 			}
 			next();
 		} else {
@@ -1435,243 +2408,1384 @@ void parse()
 	}
 }
 
-int show()
+//--------------------------------------------------------//
+// code rewriting
+
+struct assembly_code {
+	int code;
+	int param;      // for CALL/JMP/JZ/JNZ, it is the absolute target offset
+	size_t origin;  // offset in code_sec before rewriting
+	string comment;
+};
+
+vector<assembly_code> decode_code()
 {
-	if (verbose >= 1) {
-		for (size_t i = 0; i < external_code_size;) {
-			i = print_code(code_sec, i);
+	vector<assembly_code> a;
+	for (size_t i = 0; i < code_sec.size();) {
+		assembly_code e = { code_sec[i], 0, i, "" };
+		auto it = comments.find(i++);
+		if (it != comments.end()) e.comment = it->second;
+		if (instruction_has_parameter(e.code)) {
+			e.param = code_sec[i++];
+			if (instruction_is_jump(e.code)) e.param += i;
 		}
+		a.push_back(e);
 	}
-	for (size_t i = 0; i < src.size(); ++i) {
-		print_source_code_line(i);
-		auto it = offset.find(i + 1);
-		if (it != offset.end()) {
-			log(COLOR_BLUE);
-			for (size_t j = it->second.first; j <= it->second.second;) {
-				j = print_code(code_sec, j);
-			}
-			log(COLOR_NORMAL);
-		}
+	return a;
+}
+
+unordered_set<size_t> jump_targets(const vector<assembly_code>& a)
+{
+	unordered_set<size_t> targets;
+	for (const auto& e : a) {
+		if (instruction_is_jump(e.code)) targets.insert(e.param);
 	}
-	log("\n");
+	for (const auto& e : code_symbol_dict) {
+		targets.insert(e.first);
+	}
+	return targets;
+}
 
-	for (size_t i = (verbose >= 1 ? 0 : external_data_size); i < data_sec.size(); ++i) {
-		auto it = data_symbol_dict.find(i);
-		if (it != data_symbol_dict.end()) {
-			auto name = it->second;
-			auto [ is_code, offset, size, type, ret_type, arg_count ] = symbols[name];
-			string data_type = "word";
-			if (type == "const char*") data_type = "byte";
-			log(COLOR_YELLOW "%-10zd", i);
-			log(COLOR_BLUE ".%-13s", data_type.c_str());
-			size_t width = 0;
-			if (type == "const char*") {
-				log("\""); ++width;
-				const char* s = reinterpret_cast<const char*>(&data_sec[offset]);
-				for (size_t i = 0; i + 1 < size * sizeof(int); ++i) {
-					switch (s[i]) {
-						default: log("%c", s[i]); ++width; break;
-						case '\t': log("\\t"); width += 2; break;
-						case '\r': log("\\r"); width += 2; break;
-						case '\n': log("\\n"); width += 2; break;
-						case '\\': log("\\\\"); width += 2; break;
-						case '\'': log("\\\'"); width += 2; break;
-						case '\"': log("\\\""); width += 2; break;
-						case '\0': log("\\0"); width += 2; break;
-					}
-				}
-				log("\""); ++width;
-			} else {
-				for (size_t i = 0; i < size; ++i) {
-					if (i > 0) { log("  "); width += 2; }
-					log("0x%08X", static_cast<unsigned int>(data_sec[offset + i]));
-					width += 10;
-				}
-			}
-			if (width > 25) {
-				log("\n%*s", (10 + 14 + 25), "");
-			} else {
-				log("%*s", 25 - width, "");
-			}
-			log(" ; %s %s" COLOR_NORMAL "\n", type.c_str(), name.c_str());
-		}
+size_t code_index(const vector<assembly_code>& a, size_t origin) // first instruction at or after an old offset
+{
+	return static_cast<size_t>(lower_bound(a.begin(), a.end(), origin,
+				[](const assembly_code& e, size_t o) { return e.origin < o; }) - a.begin());
+}
+
+vector<bool> code_landings(const vector<assembly_code>& a)
+{
+	vector<bool> landing(a.size() + 1);
+	for (const auto& e : a) {
+		if (instruction_is_jump(e.code)) landing[code_index(a, e.param)] = true;
 	}
-	return 0;
+	for (const auto& e : code_symbol_dict) {
+		landing[code_index(a, e.first)] = true;
+	}
+	return landing;
 }
 
-void print_vm_env(int ax, int ip, int sp, int bp)
+inline bool instruction_ends_block(int code)
 {
-	log("\tax = %08X, ip = %08X, sp = %08X, bp = %08X\n", ax, ip, sp, bp);
-	log("\t[stack]: ");
-	size_t i = 0;
-	for (; i < 6 && sp + i < MEM_SIZE; ++i) {
-		if (i > 0) { log(", "); }
-		log("0x%08X", m[sp + i]);
+	return (code == JMP || code == JZ || code == JNZ || code == RET || code == EXIT || code == TAILCALL);
+}
+
+void encode_code(const vector<assembly_code>& a) // rebuild code_sec, and relocate everything referring to it
+{
+	vector<size_t> new_offset(a.size());
+	size_t size = 0;
+	for (size_t k = 0; k < a.size(); ++k) {
+		new_offset[k] = size;
+		size += (instruction_has_parameter(a[k].code) ? 2 : 1);
 	}
-	if (sp + i < MEM_SIZE) {
-		log(", ...");
+	// old offset => first instruction at or after it, and last instruction at or before it
+	vector<size_t> first(code_sec.size() + 1), last(code_sec.size() + 1);
+	for (size_t o = 0, k = 0; o <= code_sec.size(); ++o) {
+		while (k < a.size() && a[k].origin < o) ++k;
+		first[o] = (k < a.size() ? new_offset[k] : size);
 	}
-	log("\n");
-	for (size_t i = 0; i < 10 && bp != MEM_SIZE; ++i) {
-		log("\t[#%zd backtrace]: bp = %08X", i, bp);
-		if (bp == m[bp]) break;
-		log("\tm[bp] = %08X", m[bp]);
-		log("\tm[bp+1] = %08X", m[bp+1]);
-		log("\tm[bp+2] = %08X", m[bp+2]);
-		log("\tm[bp+3] = %08X", m[bp+3]);
-		log("\tm[bp+4] = %08X", m[bp+4]);
-		bp = m[bp];
-		log("\n");
+	for (size_t o = 0, k = 0; o <= code_sec.size(); ++o) {
+		while (k < a.size() && a[k].origin <= o) ++k;
+		last[o] = (k > 0 ? new_offset[k - 1] : 0);
 	}
-	if (i == 10) {
-		log("...\n");
+
+	vector<int> code;
+	comments.clear();
+	for (const auto& e : a) {
+		if (!e.comment.empty()) comments.insert(make_pair(code.size(), e.comment));
+		code.push_back(e.code);
+		if (instruction_has_parameter(e.code)) {
+			code.push_back(instruction_is_jump(e.code) ? static_cast<int>(first[e.param] - (code.size() + 1)) : e.param);
+		}
 	}
-	log("\n");
-	return;
+
+	for (auto it = offset.begin(); it != offset.end();) {
+		size_t start = first[it->second.first];
+		size_t end = last[it->second.second];
+		if (it->second.first > it->second.second || start >= size || start > end || end < first[it->second.first]) {
+			it = offset.erase(it);
+		} else {
+			it->second = make_pair(start, end);
+			++it;
+		}
+	}
+	code_symbol_dict.clear();
+	for (size_t id = 0; id < symbols.size(); ++id) {
+		auto& b = symbols[id].bindings;
+		if (!b.empty() && b.front().depth == 0 && b.front().is_code) {
+			b.front().offset = first[b.front().offset];
+			code_symbol_dict.insert(make_pair(b.front().offset, static_cast<int>(id)));
+		}
+	}
+	unordered_map<size_t, int> new_native_dict;
+	for (auto& e : native_dict) {
+		new_native_dict.insert(make_pair(first[e.first], e.second));
+	}
+	native_dict.swap(new_native_dict);
+	external_code_size = first[external_code_size];
+	code_sec.swap(code);
+	next_display_instruction = code_sec.size();
 }
 
-string get_data_symbol(size_t offset)
+int stack_effect(const assembly_code& e, bool& ok) // words pushed (or popped, if negative) by straight-line code
 {
-	auto it = data_symbol_dict.find(offset);
-	if (it == data_symbol_dict.end()) {
-		err("Unknown data symbol offset '%zd'\n", offset);
-		exit(1);
+	ok = true;
+	switch (e.code) {
+	case PUSH: case LGETPUSH: case PUSHI:
+		return 1;
+	case POP: case SGET: case SPUT:
+	case ADD: case SUB: case MUL: case DIV: case MOD:
+	case SHL: case SHR: case AND: case OR:
+	case EQ: case NE: case GE: case GT: case LE: case LT: case LAND: case LOR:
+		return -1;
+	case ADJ:
+		return -e.param;
+	case CALLX:
+		return -natives[e.param].pop;
+	case CALL: {
+		auto it = code_symbol_dict.find(e.param);
+		if (it == code_symbol_dict.end()) break;
+		return -global_symbol(it->second).arg_count;
 	}
-	return it->second;
+	case WGET: case WLGET:
+		return 2;
+	case I2L: case I2D:
+		return (e.param == 0 ? 2 : 1);
+	case LADD: case LSUB: case LMUL: case LDIV: case LMOD:
+	case DADD: case DSUB: case DMUL: case DDIV:
+	case L2I: case D2I:
+		return -2;
+	case LEQ: case LNE: case LGE: case LGT: case LLE: case LLT:
+	case DEQ: case DNE: case DGE: case DGT: case DLE: case DLT:
+		return -4;
+	case EXIT: case ENTER: case LEAVE: case RET: case JMP: case JZ: case JNZ: case TAILCALL:
+		break;
+	default:
+		return 0;
+	}
+	ok = false;
+	return 0;
 }
 
-int call_ext(const string& name, int sp)
+inline bool instruction_sets_ax(int code) // ax is set without being read
 {
-	log<3>("[DEBUG] external call: %s\n", name.c_str());
-	if (name == "operator<<(ostream,int)") {
-		int b = m[sp + 1];
-		int a = m[sp + 2];
-		log<3>("[DEBUG] args: %d, %d\n", a, b);
-		string aa = get_data_symbol(a);
-		if (aa == "cout") {
-			cout << b;
-		} else if (aa == "cerr") {
-			cerr << b;
-		} else {
-			err("Unsupported operator<< for %d('%s')\n", m[a], aa.c_str());
-			exit(1);
+	return (code == MOV || code == LEA || code == GET || code == LLEA || code == LGET ||
+			code == PUSHI || code == LGETPUSH);
+}
+
+const size_t PEEPHOLE_COPY_LIMIT = 8; // instructions of a block copied in place of a jump to it
+
+void peephole()
+{
+	auto a = decode_code();
+	size_t before = a.size();
+	auto index_of = [&](size_t origin) { // first instruction at or after an old offset
+		return static_cast<size_t>(lower_bound(a.begin(), a.end(), origin,
+					[](const assembly_code& e, size_t o) { return e.origin < o; }) - a.begin());
+	};
+
+	// `JMP t`, where t is a short block ending with JMP or RET => a copy of the block, as in
+	// `for` loops jumping to the step expression, which then jumps back to the condition.
+	// the copy keeps the origin of the JMP, so that jumps to it, and its line, stay the same
+	vector<assembly_code> b;
+	for (size_t k = 0; k < a.size(); ++k) {
+		size_t j = (a[k].code == JMP ? index_of(a[k].param) : a.size()), n = 0;
+		for (; j + n < a.size() && n < PEEPHOLE_COPY_LIMIT; ++n) {
+			int code = a[j + n].code;
+			if (code == JMP || code == RET || code == JZ || code == JNZ || code == ENTER || code == TAILCALL || code == EXIT) break;
 		}
-		return a;
-	} else if (name == "operator<<(ostream,const char*)") {
-		int b = m[sp + 1];
-		int a = m[sp + 2];
-		log<3>("[DEBUG] args: %d, %d\n", a, b);
-		string aa = get_data_symbol(a);
-		const char* s = reinterpret_cast<const char*>(&m[b]);
-		if (aa == "cout") {
-			cout << s;
-		} else if (aa == "cerr") {
-			cerr << s;
+		if (j + n < a.size() && n > 0 && j != k && (a[j + n].code == JMP || a[j + n].code == RET)) {
+			for (size_t i = 0; i <= n; ++i) {
+				b.push_back(a[j + i]);
+				b.back().origin = a[k].origin;
+			}
 		} else {
-			err("Unsupported operator<< for %d('%s')\n", m[a], aa.c_str());
-			exit(1);
+			b.push_back(a[k]);
 		}
-		return a;
-	} else if (name == "operator<<(ostream,(*)(endl_t))") {
-		int b = m[sp + 1];
-		int a = m[sp + 2];
-		log<3>("[DEBUG] args: %d, %d\n", a, b);
-		string aa = get_data_symbol(a);
-		if (aa == "cout") {
-			cout << endl;
-		} else if (aa == "cerr") {
-			cerr << endl;
-		} else {
-			err("Unsupported operator<< for %d('%s')\n", m[a], aa.c_str());
-			exit(1);
+	}
+	a.swap(b);
+
+	for (bool changed = true; changed; ) {
+		changed = false;
+		vector<bool> landing(a.size() + 1);
+		for (const auto& e : a) {
+			if (instruction_is_jump(e.code)) landing[index_of(e.param)] = true;
 		}
-		return a;
-	} else if (name == "printf(const char*,...)") {
-		int var_arg_count = m[sp + 1];
-		int var_arg_start = sp + 1 + var_arg_count;
-		const char* fmt = reinterpret_cast<const char*>(&m[m[var_arg_start + 1]]);
-		int n = 0;
-		for (int i = 0; *fmt; ++fmt) {
-			if (*fmt == '%') {
-				char c = *++fmt;
-				if (c == 'd' || c == 'c') {
-					if (i >= var_arg_count) { n += printf("<missing>"); }
-					else { n += printf((c == 'd' ? "%d" : "%c"), m[var_arg_start - i]); }
-					++i;
-				} else if (c == 's' || c == 'p') {
-					if (i >= var_arg_count) { n += printf("<missing>"); }
-					else { n += printf((c == 's' ? "%s" : "%p"), reinterpret_cast<const char*>(&m[m[var_arg_start - i]])); }
-					++i;
-				} else {
-					n += printf("%c", c);
+		for (const auto& e : code_symbol_dict) {
+			landing[index_of(e.first)] = true;
+		}
+
+		vector<bool> removed(a.size());
+		bool reachable = true;
+		for (size_t k = 0; k < a.size(); ++k) {
+			auto& e = a[k];
+			if (landing[k]) reachable = true;
+			if (!reachable) { // dead code after an unconditional transfer
+				removed[k] = true;
+				continue;
+			}
+			if (e.code == JMP || e.code == JZ || e.code == JNZ) { // thread jumps to jumps
+				for (size_t hops = 0, t = index_of(e.param); t < a.size() && a[t].code == JMP && t != k && hops < a.size(); ++hops) {
+					e.param = a[t].param;
+					t = index_of(e.param);
+					changed = true;
 				}
-			} else {
-				n += printf("%c", *fmt);
+				if (index_of(e.param) == k + 1) { // to the next instruction
+					removed[k] = true;
+					continue;
+				}
+			}
+			if (e.code == JMP || e.code == RET) {
+				reachable = false;
+			} else if (e.code == ADJ && e.param == 0) {
+				removed[k] = true;
+			} else if (e.code == PUSH && k + 1 < a.size() && a[k + 1].code == POP && !landing[k + 1]) {
+				removed[k] = removed[k + 1] = true;
+				++k;
+			} else if ((e.code == MOV || e.code == LEA || e.code == GET || e.code == LLEA || e.code == LGET) &&
+					k + 1 < a.size() && instruction_sets_ax(a[k + 1].code)) { // ax is overwritten right away
+				removed[k] = true;
 			}
 		}
-		return n;
-	} else {
-		err("Unsupported function '%s'\n", name.c_str());
-		exit(1);
+		vector<assembly_code> c;
+		for (size_t k = 0; k < a.size(); ++k) {
+			if (!removed[k]) c.push_back(a[k]); else changed = true;
+		}
+		a.swap(c);
 	}
+	log<1>("[DEBUG] peephole: %zd => %zd instruction(s)\n", before, a.size());
+	encode_code(a);
 }
 
-int run(int argc, const char** argv)
+const size_t INLINE_LIMIT = 12; // instructions in the body of a function inlined at its call sites
+
+struct inline_callee {
+	bool ok;
+	size_t first, last; // body [first, last), between `ENTER` and `LEAVE; RET`
+	int locals, args;
+};
+
+// a small function with a straight-line body, not calling itself, can be inlined
+inline_callee inline_candidate(const vector<assembly_code>& a, size_t entry)
 {
-	// vm register
-	int ax = 0, ip = 0, sp = MEM_SIZE, bp = MEM_SIZE;
+	inline_callee f = { false, entry + 1, entry + 1, 0, 0 };
+	auto it = code_symbol_dict.find(a[entry].origin);
+	if (it == code_symbol_dict.end() || a[entry].code != ENTER) return f;
+	f.locals = a[entry].param;
+	f.args = global_symbol(it->second).arg_count;
+	for (; f.last < a.size() && f.last - f.first <= INLINE_LIMIT; ++f.last) {
+		const auto& e = a[f.last];
+		if (e.code == LEAVE) break;
+		if (instruction_ends_block(e.code) || e.code == ENTER || e.code == RET) return f;
+		if (e.code == CALL && code_index(a, e.param) == entry) return f;
+		if (instruction_is_wide(e.code)) return f;
+		if ((e.code == LGET || e.code == LPUT || e.code == LLEA) && (e.param == 0 || e.param == 1 || e.param > f.args + 1)) return f;
+	}
+	f.ok = (f.last - f.first <= INLINE_LIMIT && f.last + 1 < a.size() &&
+			a[f.last].code == LEAVE && a[f.last + 1].code == RET && a[f.last + 1].param == f.args);
+	return f;
+}
 
-	// load code & data
-	log<1>("Loading program\n  data: %zd word(s)\n  code: %zd word(s)\n\n",
-			data_sec.size(), code_sec.size());
+// the `PUSH` of each argument of the call at k, the last one first, all in the same block
+bool argument_pushes(const vector<assembly_code>& a, size_t k, int args, const vector<bool>& landing, vector<size_t>& pushes)
+{
+	int height = 0; // relative to that right before the call
+	for (size_t j = k; j-- > 0 && static_cast<int>(pushes.size()) < args; ) {
+		if (instruction_ends_block(a[j].code) || a[j].code == ENTER) return false;
+		bool ok;
+		int effect = stack_effect(a[j], ok);
+		if (!ok) return false;
+		if (a[j].code == PUSH && height == -static_cast<int>(pushes.size())) pushes.push_back(j);
+		height -= effect;
+		if (landing[j] && static_cast<int>(pushes.size()) < args) return false;
+	}
+	return static_cast<int>(pushes.size()) == args;
+}
+
+// `PUSH <arg>...; CALL f` => `LPUT <slot>...; <body of f>`, with the arguments and locals of f
+// remapped to new slots in the frame of the caller
+void inline_calls()
+{
+	auto a = decode_code();
+	auto landing = code_landings(a);
+	map<size_t, inline_callee> callees;
+	map<size_t, int> argument_slot;                // PUSH => slot
+	map<size_t, pair<size_t, int>> inlined;        // CALL => (entry of callee, base slot)
+	for (size_t caller = 0, k = 0; k < a.size(); ++k) {
+		if (a[k].code == ENTER) caller = k;
+		if (a[k].code != CALL || a[caller].code != ENTER) continue;
+		size_t entry = code_index(a, a[k].param);
+		if (entry >= a.size() || entry == caller) continue;
+		auto it = callees.find(entry);
+		if (it == callees.end()) it = callees.insert(make_pair(entry, inline_candidate(a, entry))).first;
+		const auto& f = it->second;
+		vector<size_t> pushes;
+		if (!f.ok || !argument_pushes(a, k, f.args, landing, pushes)) continue;
 
-	size_t loaded = 0;
-	for (size_t i = 0; i < data_sec.size(); ++i) {
-		m[loaded++] = data_sec[i];
+		int base = a[caller].param;
+		a[caller].param += f.locals + f.args;
+		for (int i = 0; i < f.args; ++i) { // the last argument is pushed last, at offset 2 of the callee
+			argument_slot[pushes[i]] = -(base + f.locals + 1 + i);
+		}
+		inlined[k] = make_pair(entry, base);
 	}
-	int code_loading_position = loaded;
-	for (size_t i = 0; i < code_sec.size(); ++i) {
-		m[loaded++] = code_sec[i];
+
+	vector<assembly_code> b;
+	for (size_t k = 0; k < a.size(); ++k) {
+		auto it = argument_slot.find(k);
+		auto jt = inlined.find(k);
+		if (it != argument_slot.end()) {
+			b.push_back({ LPUT, it->second, a[k].origin, "inline argument" });
+		} else if (jt != inlined.end()) {
+			const auto& f = callees[jt->second.first];
+			int base = jt->second.second;
+			for (size_t j = f.first; j < f.last; ++j) {
+				auto e = a[j];
+				if (e.code == LGET || e.code == LPUT || e.code == LLEA) {
+					e.param = (e.param < 0 ? e.param - base : -(base + f.locals + e.param - 1));
+				}
+				e.origin = a[k].origin;
+				b.push_back(e);
+			}
+		} else {
+			b.push_back(a[k]);
+		}
 	}
+	log<1>("[DEBUG] inline: %zd call(s) inlined\n", inlined.size());
+	encode_code(b);
+}
 
-	// find start entry
-	auto it = override_functions.find("main");
-	if (it == override_functions.end() || it->second.empty()) {
-		err("main() not defined!\n");
-		return -1;
+void fuse()
+{
+	auto a = decode_code();
+	auto targets = jump_targets(a);
+	auto is_target = [&](const assembly_code& e) { return targets.find(e.origin) != targets.end(); };
+
+	// `LLEA x; PUSH; ...; SPUT` => `...; LPUT x`, and `LEA x; PUSH; ...; SPUT` => `...; PUT x`
+	vector<bool> removed(a.size());
+	for (size_t k = 0; k + 2 < a.size(); ++k) {
+		if ((a[k].code != LLEA && a[k].code != LEA) || a[k + 1].code != PUSH) continue;
+		if (!instruction_sets_ax(a[k + 2].code)) continue;
+		int depth = 0;
+		for (size_t j = k + 1; j < a.size(); ++j) {
+			if (is_target(a[j])) break;
+			if (j > k + 1 && a[j].code == SPUT && depth == 1) {
+				a[j].code = (a[k].code == LLEA ? LPUT : PUT);
+				a[j].param = a[k].param;
+				a[j].comment = a[k].comment;
+				removed[k] = removed[k + 1] = true;
+				break;
+			}
+			bool ok;
+			depth += stack_effect(a[j], ok);
+			if (!ok || depth <= 0) break; // the address has been consumed by others
+		}
 	}
-	if (it->second.size() > 1) {
-		err("duplcated definition of main()!\n");
-		return -1;
+	vector<assembly_code> c;
+	for (size_t k = 0; k < a.size(); ++k) {
+		if (!removed[k]) c.push_back(a[k]);
 	}
-	auto it2 = symbols.find(*(it->second.begin()));
-	ip = code_loading_position + get<1>(it2->second);
 
-	// prepare argc & argv
-	sp -= argc + 1;
-	int argv_copy = sp;
-	for (int i = 0; i < argc; ++i) {
-		size_t len = strlen(argv[i]);
-		size_t size = (len + sizeof(int)) / sizeof(int);
-		m[sp - 1] = 0;
-		sp -= size;
-		m[argv_copy + i] = sp;
-		memcpy(&m[sp], argv[i], len);
+	// `PUSH; MOV k; <op>` => `<op>I k`
+	auto fused_op = [&](size_t j) {
+		if (j + 2 >= c.size() || c[j].code != PUSH || c[j + 1].code != MOV) return INVALID;
+		if (is_target(c[j + 1]) || is_target(c[j + 2])) return INVALID;
+		switch (c[j + 2].code) {
+		case ADD: return ADDI; case SUB: return SUBI; case MUL: return MULI;
+		case EQ: return EQI; case NE: return NEI; case GE: return GEI;
+		case GT: return GTI; case LE: return LEI; case LT: return LTI;
+		default: return INVALID;
+		}
+	};
+	vector<assembly_code> b;
+	for (size_t k = 0; k < c.size(); ++k) {
+		auto e = c[k];
+		instruction op = fused_op(k);
+		if (op != INVALID) { // `PUSH; MOV k; <op>` => `<op>I k`
+			e = { op, c[k + 1].param, c[k].origin, c[k + 1].comment };
+			k += 2;
+		} else if ((e.code == LGET || e.code == MOV) && k + 1 < c.size() && c[k + 1].code == PUSH &&
+				!is_target(c[k + 1]) && fused_op(k + 1) == INVALID) { // `LGET x; PUSH` => `LGETPUSH x`, `MOV k; PUSH` => `PUSHI k`
+			e.code = (e.code == LGET ? LGETPUSH : PUSHI);
+			k += 1;
+		}
+		b.push_back(e);
 	}
-	m[argv_copy + argc] = 0;
-	if (verbose >= 3) {
-		log("[DEBUG] prepare argc & argv:\n");
-		for (int i = sp; i < MEM_SIZE; i += 4) {
-			log("[DEBUG] %08X:  ", i);
-			for (int j = 0; j < 4; ++j) {
-				if (i + j < MEM_SIZE) {
+	log<1>("[DEBUG] fuse: %zd => %zd instruction(s)\n", a.size(), b.size());
+	encode_code(b);
+}
+
+//--------------------------------------------------------//
+// basic block optimizer
+
+// for '-O2', the code of each function is split into basic blocks over a control flow
+// graph, with the values in ax and on the stack numbered as virtual values
+
+struct basic_block {
+	size_t first, last;        // instructions [first, last)
+	vector<size_t> succ, pred; // blocks of the same function
+};
+
+vector<pair<size_t, size_t>> code_functions(const vector<assembly_code>& a) // [begin, end) of each function
+{
+	set<size_t> entries;
+	for (const auto& e : code_symbol_dict) {
+		size_t k = code_index(a, e.first);
+		if (k < a.size() && a[k].code == ENTER) entries.insert(k);
+	}
+	vector<pair<size_t, size_t>> functions;
+	for (auto it = entries.begin(); it != entries.end(); ++it) {
+		auto next = std::next(it);
+		functions.push_back(make_pair(*it, next != entries.end() ? *next : a.size()));
+	}
+	return functions;
+}
+
+vector<basic_block> build_blocks(const vector<assembly_code>& a, size_t begin, size_t end, const vector<bool>& landing)
+{
+	vector<basic_block> blocks;
+	vector<size_t> block_of(end - begin);
+	for (size_t k = begin; k < end; ++k) {
+		if (k == begin || landing[k] || instruction_ends_block(a[k - 1].code)) blocks.push_back({ k, k, {}, {} });
+		blocks.back().last = k + 1;
+		block_of[k - begin] = blocks.size() - 1;
+	}
+	auto link = [&](size_t from, size_t to) {
+		auto& succ = blocks[from].succ;
+		if (find(succ.begin(), succ.end(), to) != succ.end()) return;
+		succ.push_back(to);
+		blocks[to].pred.push_back(from);
+	};
+	for (size_t i = 0; i < blocks.size(); ++i) {
+		const auto& e = a[blocks[i].last - 1];
+		if (e.code == JMP || e.code == JZ || e.code == JNZ) {
+			size_t t = code_index(a, e.param);
+			if (t >= begin && t < end) link(i, block_of[t - begin]); // else a tail call
+		}
+		if (e.code != JMP && e.code != RET && e.code != EXIT && i + 1 < blocks.size()) link(i, i + 1);
+	}
+	return blocks;
+}
+
+vector<vector<bool>> dominators(const vector<basic_block>& blocks) // [i][j]: block j dominates block i
+{
+	size_t n = blocks.size();
+	vector<vector<bool>> dom(n, vector<bool>(n, true));
+	dom[0].assign(n, false);
+	dom[0][0] = true;
+	for (bool changed = true; changed; ) {
+		changed = false;
+		for (size_t i = 1; i < n; ++i) {
+			vector<bool> d(n, !blocks[i].pred.empty());
+			for (auto p : blocks[i].pred) {
+				for (size_t j = 0; j < n; ++j) d[j] = d[j] && dom[p][j];
+			}
+			d[i] = true;
+			if (d != dom[i]) {
+				dom[i].swap(d);
+				changed = true;
+			}
+		}
+	}
+	return dom;
+}
+
+// index of the SPUT storing through the address pushed by `LLEA/LEA x; PUSH` at k
+size_t address_store(const vector<assembly_code>& a, size_t k, size_t end, const vector<bool>& landing)
+{
+	if (k + 2 >= end || (a[k].code != LLEA && a[k].code != LEA) || a[k + 1].code != PUSH) return SIZE_MAX;
+	if (!instruction_sets_ax(a[k + 2].code)) return SIZE_MAX;
+	int depth = 0;
+	for (size_t j = k + 1; j < end && !landing[j]; ++j) {
+		if (j > k + 1 && a[j].code == SPUT && depth == 1) return j;
+		bool ok;
+		depth += stack_effect(a[j], ok);
+		if (!ok || depth <= 0) break;
+	}
+	return SIZE_MAX;
+}
+
+vector<assembly_code> remove_unreachable(const vector<assembly_code>& a)
+{
+	auto landing = code_landings(a);
+	vector<bool> removed(a.size());
+	for (const auto& f : code_functions(a)) {
+		auto blocks = build_blocks(a, f.first, f.second, landing);
+		vector<bool> reachable(blocks.size());
+		vector<size_t> todo = { 0 };
+		reachable[0] = true;
+		while (!todo.empty()) {
+			size_t i = todo.back();
+			todo.pop_back();
+			for (auto s : blocks[i].succ) {
+				if (!reachable[s]) { reachable[s] = true; todo.push_back(s); }
+			}
+		}
+		for (size_t i = 0; i < blocks.size(); ++i) {
+			if (reachable[i]) continue;
+			for (size_t k = blocks[i].first; k < blocks[i].last; ++k) removed[k] = true;
+		}
+	}
+	vector<assembly_code> b;
+	for (size_t k = 0; k < a.size(); ++k) {
+		if (!removed[k]) b.push_back(a[k]);
+	}
+	return b;
+}
+
+inline bool instruction_is_pure(int code) // changes nothing but ax and the stack
+{
+	return (code == MOV || code == LEA || code == GET || code == LLEA || code == LGET || code == SGET ||
+			code == PUSH || code == POP || (code >= ADD && code <= LNOT));
+}
+
+inline bool instruction_is_unary(int code)
+{
+	return (code == NEG || code == INC || code == DEC || code == NOT || code == LNOT);
+}
+
+struct value_numbering {
+	map<tuple<int, int, int, int>, int> values; // (instruction, parameter, operands) => value
+	map<pair<int, int>, int> memory;            // (LGET/GET, offset) => value stored there
+	map<int, pair<int, int>> addresses;         // value => (LGET/GET, offset) it points to
+	vector<int> stack;                          // values pushed since the lowest depth reached
+	int ax = 0, depth = 0, next = 1, epoch = 0;
+
+	int value(int code, int param, int x = 0, int y = 0) {
+		auto it = values.insert(make_pair(make_tuple(code, param, x, y), next));
+		if (it.second) ++next;
+		return it.first->second;
+	}
+	int load(pair<int, int> slot) {
+		auto it = memory.insert(make_pair(slot, next));
+		if (it.second) ++next;
+		return it.first->second;
+	}
+	int pop() {
+		--depth;
+		if (stack.empty()) return value(INVALID, depth, epoch); // a value pushed before the block
+		int v = stack.back();
+		stack.pop_back();
+		return v;
+	}
+	void reset() {
+		memory.clear();
+		stack.clear();
+		ax = next++;
+		depth = 0;
+		++epoch;
+	}
+	vector<int> state() const {
+		vector<int> s = { ax, depth };
+		s.insert(s.end(), stack.begin(), stack.end());
+		return s;
+	}
+	void step(const assembly_code& e) {
+		switch (e.code) {
+		case MOV: ax = value(MOV, e.param); break;
+		case LEA:  ax = value(LEA, e.param);  addresses[ax] = make_pair(GET, e.param); break;
+		case LLEA: ax = value(LLEA, e.param); addresses[ax] = make_pair(LGET, e.param); break;
+		case GET: case LGET: ax = load(make_pair(e.code, e.param)); break;
+		case PUT: case LPUT: memory[make_pair(e.code == PUT ? GET : LGET, e.param)] = ax; ++epoch; break;
+		case SGET: {
+			int addr = pop();
+			auto it = addresses.find(addr);
+			ax = (it != addresses.end() ? load(it->second) : value(SGET, 0, addr, epoch));
+			break;
+		}
+		case SPUT: {
+			auto it = addresses.find(pop());
+			if (it == addresses.end()) memory.clear(); // may be anywhere
+			else memory[it->second] = ax;
+			++epoch;
+			break;
+		}
+		case PUSH: stack.push_back(ax); ++depth; break;
+		case POP: ax = pop(); break;
+		default:
+			if (instruction_is_unary(e.code)) {
+				ax = value(e.code, 0, ax);
+			} else if (e.code >= ADD && e.code <= LNOT) {
+				int x = pop();
+				ax = value(e.code, 0, x, ax);
+			} else {
+				reset();
+			}
+		}
+	}
+};
+
+// within each block, pure code leaving ax and the stack as they were is removed, such as
+// common subexpressions (`a*b + a*b`) and loads of what has just been stored (`LPUT x; LGET x`)
+vector<assembly_code> number_values(const vector<assembly_code>& a)
+{
+	auto landing = code_landings(a);
+	vector<bool> removed(a.size());
+	value_numbering vn;
+	for (const auto& f : code_functions(a)) {
+		for (const auto& b : build_blocks(a, f.first, f.second, landing)) {
+			map<vector<int>, size_t> seen; // state => position (before that instruction)
+			vector<pair<vector<int>, size_t>> history;
+			auto record = [&](size_t pos) {
+				auto s = vn.state();
+				auto it = seen.find(s);
+				if (it != seen.end()) { // nothing changed since then
+					for (size_t k = it->second; k < pos; ++k) removed[k] = true;
+					while (!history.empty() && history.back().second > it->second) {
+						seen.erase(history.back().first);
+						history.pop_back();
+					}
+				} else {
+					seen.insert(make_pair(s, pos));
+					history.push_back(make_pair(s, pos));
+				}
+			};
+			vn.reset();
+			record(b.first);
+			for (size_t k = b.first; k < b.last; ++k) {
+				vn.step(a[k]);
+				if (!instruction_is_pure(a[k].code)) {
+					seen.clear();
+					history.clear();
+				}
+				record(k + 1);
+			}
+		}
+	}
+	vector<assembly_code> c;
+	for (size_t k = 0; k < a.size(); ++k) {
+		if (!removed[k]) c.push_back(a[k]);
+	}
+	return c;
+}
+
+// pure code computing a value from constants, and from variables a loop does not store to, is
+// moved in front of the loop, and its value kept in a new local slot of the function
+vector<assembly_code> hoist_invariants(vector<assembly_code> a)
+{
+	auto landing = code_landings(a);
+	map<size_t, vector<assembly_code>> inserted; // instruction => code inserted before it
+	map<size_t, pair<size_t, int>> hoisted;      // first instruction => (last one, slot)
+	vector<bool> taken(a.size());                // instructions already hoisted
+	for (const auto& f : code_functions(a)) {
+		auto blocks = build_blocks(a, f.first, f.second, landing);
+		auto dom = dominators(blocks);
+
+		set<size_t> known_stores; // SPUT through `LLEA/LEA x; PUSH`
+		bool address_taken = false;
+		for (size_t k = f.first; k < f.second; ++k) {
+			if (a[k].code != LLEA && a[k].code != LEA) continue;
+			size_t j = address_store(a, k, f.second, landing);
+			if (j != SIZE_MAX) known_stores.insert(j);
+			else if (a[k].code == LLEA) address_taken = true;
+		}
+
+		map<size_t, set<size_t>> loops; // header => blocks
+		for (size_t i = 0; i < blocks.size(); ++i) {
+			for (auto h : blocks[i].succ) {
+				if (!dom[i][h]) continue; // not a back edge
+				auto& body = loops[h];
+				body.insert(h);
+				vector<size_t> todo;
+				if (body.insert(i).second) todo.push_back(i);
+				while (!todo.empty()) {
+					size_t j = todo.back();
+					todo.pop_back();
+					for (auto p : blocks[j].pred) {
+						if (body.insert(p).second) todo.push_back(p);
+					}
+				}
+			}
+		}
+		vector<pair<size_t, size_t>> order; // innermost loops first
+		for (const auto& e : loops) order.push_back(make_pair(e.second.size(), e.first));
+		sort(order.begin(), order.end());
+
+		for (const auto& o : order) {
+			size_t h = o.second;
+			const auto& body = loops[h];
+			// the only way into the loop from outside must be to fall through from the block before it
+			size_t first = blocks[h].first;
+			if (h == 0 || body.count(h - 1) || a[first - 1].origin >= a[first].origin) continue;
+			const auto& e = a[blocks[h - 1].last - 1];
+			if ((instruction_is_jump(e.code) && code_index(a, e.param) == first) || e.code == JMP || e.code == RET) continue;
+			bool entered_elsewhere = false;
+			for (auto p : blocks[h].pred) {
+				if (p != h - 1 && !body.count(p)) entered_elsewhere = true;
+			}
+			if (entered_elsewhere) continue;
+
+			set<pair<int, int>> stored;
+			bool unknown_stores = false;
+			for (auto i : body) {
+				for (size_t k = blocks[i].first; k < blocks[i].last; ++k) {
+					int code = a[k].code;
+					if (code == PUT || code == LPUT) stored.insert(make_pair(code == PUT ? GET : LGET, a[k].param));
+					if (code == WPUT || code == WLPUT) { // both words of a wide value
+						stored.insert(make_pair(code == WPUT ? GET : LGET, a[k].param));
+						stored.insert(make_pair(code == WPUT ? GET : LGET, a[k].param + 1));
+					}
+					if (code == CALL || code == TAILCALL || (code == SPUT && !known_stores.count(k))) unknown_stores = true;
+				}
+			}
+			for (size_t k = f.first; k < f.second; ++k) {
+				size_t j = address_store(a, k, f.second, landing);
+				if (j != SIZE_MAX && known_stores.count(j) && body.count(upper_bound(blocks.begin(), blocks.end(), j,
+								[](size_t x, const basic_block& b) { return x < b.first; }) - blocks.begin() - 1)) {
+					stored.insert(make_pair(a[k].code == LEA ? GET : LGET, a[k].param));
+				}
+			}
+			auto invariant = [&](const assembly_code& e) {
+				switch (e.code) {
+				case MOV: case LEA: case LLEA: return true;
+				case GET: return !unknown_stores && !stored.count(make_pair(GET, e.param));
+				case LGET: return !(unknown_stores && address_taken) && !stored.count(make_pair(LGET, e.param));
+				case PUSH: case POP: return true;
+				case DIV: case MOD: return false; // may trap, when the loop is not run at all
+				default: return (e.code >= ADD && e.code <= LNOT);
+				}
+			};
+
+			vector<assembly_code> pre;
+			for (auto i : body) {
+				for (size_t s = blocks[i].first; s < blocks[i].last; ++s) {
+					if (!instruction_sets_ax(a[s].code) || !invariant(a[s]) || taken[s]) continue;
+					size_t end = SIZE_MAX;
+					bool computed = false;
+					for (size_t j = s + 1, depth = 0; j < blocks[i].last && invariant(a[j]) && !taken[j]; ++j) {
+						if (a[j].code == PUSH) {
+							++depth;
+						} else if (a[j].code == POP || (a[j].code >= ADD && a[j].code <= LNOT && !instruction_is_unary(a[j].code))) {
+							if (depth == 0) break;
+							--depth;
+						}
+						if (a[j].code >= ADD && a[j].code <= LNOT) computed = true;
+						if (depth == 0 && computed) end = j;
+					}
+					if (end == SIZE_MAX) continue;
+					int slot = -(++a[f.first].param);
+					for (size_t k = s; k <= end; ++k) {
+						taken[k] = true;
+						pre.push_back(a[k]);
+						pre.back().origin = a[first].origin - 1;
+					}
+					pre.push_back({ LPUT, slot, a[first].origin - 1, "loop invariant" });
+					hoisted.insert(make_pair(s, make_pair(end, slot)));
+					s = end;
+				}
+			}
+			if (!pre.empty()) inserted.insert(make_pair(first, pre));
+		}
+	}
+
+	vector<assembly_code> b;
+	for (size_t k = 0; k < a.size(); ++k) {
+		auto it = inserted.find(k);
+		if (it != inserted.end()) b.insert(b.end(), it->second.begin(), it->second.end());
+		auto jt = hoisted.find(k);
+		if (jt != hoisted.end()) {
+			b.push_back({ LGET, jt->second.second, a[k].origin, "loop invariant" });
+			k = jt->second.first;
+		} else {
+			b.push_back(a[k]);
+		}
+	}
+	return b;
+}
+
+void optimize()
+{
+	auto a = decode_code();
+	size_t before = a.size();
+	a = hoist_invariants(number_values(remove_unreachable(a)));
+	log<1>("[DEBUG] optimize: %zd => %zd instruction(s)\n", before, a.size());
+	encode_code(a);
+}
+
+//--------------------------------------------------------//
+// register backend
+//
+// the stack bytecode is translated into three-address code, whose registers
+// are slots of the stack frame (register r is m[bp + r]): locals and arguments
+// are used in place, and the i-th stack temporary lives in the slot just below
+// the locals, where the stack machine would have pushed it. values of ax and
+// of the pushed operands are tracked lazily during translation, so that
+// `LGET b; PUSH; LGET c; ADD; LPUT a` becomes `ADD t, b, c; MOV a, t`.
+
+enum reg_instruction {
+	R_EXIT,  R_MOV,   R_MOVI,  R_LEA,  R_GET,  R_PUT,  R_PUTI,  R_LOAD, R_STORE, R_STOREI,
+	R_GETAX, R_SETAX, R_SETAXI,
+	R_ADD,   R_SUB,   R_MUL,   R_DIV,  R_MOD,  R_SHL,  R_SHR,   R_AND,  R_OR,
+	R_EQ,    R_NE,    R_GE,    R_GT,   R_LE,   R_LT,   R_LAND,  R_LOR,
+	R_ADDI,  R_SUBI,  R_MULI,  R_DIVI, R_MODI, R_SHLI, R_SHRI,  R_ANDI, R_ORI,
+	R_EQI,   R_NEI,   R_GEI,   R_GTI,  R_LEI,  R_LTI,  R_LANDI, R_LORI,
+	R_NEG,   R_INC,   R_DEC,   R_NOT,  R_LNOT,
+	R_ENTER, R_LEAVE, R_CALL,  R_CALLX, R_TAILCALL, R_RET, R_JMP, R_JZ, R_JNZ, R_JZR, R_JNZR,
+	R_WIDE,
+	R_INVALID,
+};
+
+// name, and kinds of operands: 'r' for register, 'k' for immediate, 'a' for memory address, 't' for jump target
+const pair<const char*, const char*> reg_instruction_info[] = {
+	{ "EXIT", "" }, { "MOV", "rr" }, { "MOVI", "rk" }, { "LEA", "rk" }, { "GET", "ra" },
+	{ "PUT", "ar" }, { "PUTI", "ak" }, { "LOAD", "rr" }, { "STORE", "rr" }, { "STOREI", "rk" },
+	{ "GETAX", "r" }, { "SETAX", "r" }, { "SETAXI", "k" },
+	{ "ADD", "rrr" }, { "SUB", "rrr" }, { "MUL", "rrr" }, { "DIV", "rrr" }, { "MOD", "rrr" },
+	{ "SHL", "rrr" }, { "SHR", "rrr" }, { "AND", "rrr" }, { "OR", "rrr" },
+	{ "EQ", "rrr" }, { "NE", "rrr" }, { "GE", "rrr" }, { "GT", "rrr" },
+	{ "LE", "rrr" }, { "LT", "rrr" }, { "LAND", "rrr" }, { "LOR", "rrr" },
+	{ "ADDI", "rrk" }, { "SUBI", "rrk" }, { "MULI", "rrk" }, { "DIVI", "rrk" }, { "MODI", "rrk" },
+	{ "SHLI", "rrk" }, { "SHRI", "rrk" }, { "ANDI", "rrk" }, { "ORI", "rrk" },
+	{ "EQI", "rrk" }, { "NEI", "rrk" }, { "GEI", "rrk" }, { "GTI", "rrk" },
+	{ "LEI", "rrk" }, { "LTI", "rrk" }, { "LANDI", "rrk" }, { "LORI", "rrk" },
+	{ "NEG", "rr" }, { "INC", "rr" }, { "DEC", "rr" }, { "NOT", "rr" }, { "LNOT", "rr" },
+	{ "ENTER", "k" }, { "LEAVE", "" }, { "CALL", "tk" }, { "CALLX", "kk" }, { "TAILCALL", "kk" }, { "RET", "k" },
+	{ "JMP", "t" }, { "JZ", "t" }, { "JNZ", "t" }, { "JZR", "rt" }, { "JNZR", "rt" },
+	{ "WIDE", "kkr" }, // wide instruction and its parameter, run on the stack at the register
+};
+
+const size_t REG_CODE_SIZE = 4; // [ instruction, operand, operand, operand ]
+
+size_t print_reg_code(size_t ip)
+{
+	const int* c = &reg_code[ip];
+	log(COLOR_YELLOW "%-10zd" COLOR_BLUE, ip);
+	if (c[0] >= 0 && c[0] < R_INVALID) {
+		auto [ name, operands ] = reg_instruction_info[c[0]];
+		string s;
+		for (size_t i = 0; operands[i]; ++i) {
+			char buf[32];
+			if      (operands[i] == 'r') snprintf(buf, sizeof(buf), "[bp%+d]", c[i + 1]);
+			else if (operands[i] == 'a') snprintf(buf, sizeof(buf), "[%d]", c[i + 1]);
+			else                         snprintf(buf, sizeof(buf), "%d", c[i + 1]);
+			s += (i > 0 ? ", " : "") + string(buf);
+		}
+		log("%-14s%-25s", name, s.c_str());
+	} else {
+		log("<0x%08X>  %-25s", c[0], "");
+	}
+	auto it = reg_comments.find(ip);
+	if (it != reg_comments.end()) {
+		log(" ; %s", it->second.c_str());
+	}
+	log(COLOR_NORMAL "\n");
+	return ip + REG_CODE_SIZE;
+}
+
+struct reg_operand {
+	enum kind_t { imm, reg, laddr, acc } kind; // value is: immediate, in register, address of local, in ax
+	int v;
+};
+
+struct reg_translator {
+	vector<reg_operand> stack; // operands pushed, but maybe not stored yet
+	reg_operand ax = { reg_operand::acc, 0 };
+	int frame = 0; // size of locals in current stack frame
+	vector<pair<size_t, size_t>> fixups; // [ { offset in reg_code, target offset in code_sec } ]
+
+	int home(size_t i) { return -frame - 1 - static_cast<int>(i); } // register of the i-th stack temporary
+	bool is_home(int r) { return r < -frame; }
+
+	void emit(int code, int a = 0, int b = 0, int c = 0)
+	{
+		reg_code.insert(reg_code.end(), { code, a, b, c });
+	}
+
+	void emit_jump(int code, int a, size_t target)
+	{
+		emit(code, a, 0);
+		fixups.push_back(make_pair(reg_code.size() - (code == R_JZR || code == R_JNZR ? 2 : 3), target));
+	}
+
+	int to_reg(reg_operand& x, int r) // let x be in a register, using register r if needed
+	{
+		if      (x.kind == reg_operand::imm  ) emit(R_MOVI, r, x.v);
+		else if (x.kind == reg_operand::laddr) emit(R_LEA, r, x.v);
+		else if (x.kind == reg_operand::acc  ) emit(R_GETAX, r);
+		else return x.v;
+		x = { reg_operand::reg, r };
+		return r;
+	}
+
+	void to_ax()
+	{
+		if      (ax.kind == reg_operand::imm) emit(R_SETAXI, ax.v);
+		else if (ax.kind == reg_operand::reg) emit(R_SETAX, ax.v);
+		else if (ax.kind == reg_operand::laddr) emit(R_SETAX, to_reg(ax, home(stack.size())));
+		ax = { reg_operand::acc, 0 };
+	}
+
+	void spill(size_t i) // store the i-th operand in its home register
+	{
+		auto& x = stack[i];
+		if (x.kind == reg_operand::reg) {
+			if (x.v == home(i)) return;
+			emit(R_MOV, home(i), x.v);
+			x.v = home(i);
+		} else {
+			to_reg(x, home(i));
+		}
+	}
+
+	void spill_stack()
+	{
+		for (size_t i = 0; i < stack.size(); ++i) spill(i);
+	}
+
+	void spill_locals(int r, bool all) // before local r (or any local, through a pointer) is changed
+	{
+		for (size_t i = 0; i < stack.size(); ++i) {
+			const auto& x = stack[i];
+			if (x.kind == reg_operand::reg && !is_home(x.v) && (all || x.v == r)) spill(i);
+		}
+	}
+
+	void push()
+	{
+		if (ax.kind == reg_operand::acc) to_reg(ax, home(stack.size()));
+		stack.push_back(ax);
+	}
+
+	reg_operand pop()
+	{
+		if (stack.empty()) {
+			err("register backend: unbalanced stack!\n");
+			exit(1);
+		}
+		auto x = stack.back();
+		stack.pop_back();
+		return x;
+	}
+
+	void store_local(int r)
+	{
+		spill_locals(r, false);
+		if (ax.kind == reg_operand::reg && ax.v == r) return;
+		if      (ax.kind == reg_operand::reg  ) emit(R_MOV, r, ax.v);
+		else if (ax.kind == reg_operand::imm  ) emit(R_MOVI, r, ax.v);
+		else if (ax.kind == reg_operand::laddr) emit(R_LEA, r, ax.v);
+		else { emit(R_GETAX, r); ax = { reg_operand::reg, r }; }
+	}
+
+	void store_global(int addr)
+	{
+		if (ax.kind == reg_operand::imm) {
+			emit(R_PUTI, addr, ax.v);
+		} else {
+			emit(R_PUT, addr, to_reg(ax, home(stack.size())));
+		}
+	}
+
+	void load(reg_operand addr) // SGET
+	{
+		if (addr.kind == reg_operand::laddr) {
+			ax = { reg_operand::reg, addr.v };
+			return;
+		}
+		int r = home(stack.size());
+		if (addr.kind == reg_operand::imm) {
+			emit(R_GET, r, addr.v);
+		} else {
+			emit(R_LOAD, r, to_reg(addr, r));
+		}
+		ax = { reg_operand::reg, r };
+	}
+
+	void store(reg_operand addr) // SPUT
+	{
+		if (addr.kind == reg_operand::laddr) {
+			store_local(addr.v);
+		} else if (addr.kind == reg_operand::imm) {
+			store_global(addr.v);
+		} else {
+			int a = to_reg(addr, home(stack.size()));
+			if (ax.kind == reg_operand::imm) {
+				emit(R_STOREI, a, ax.v);
+			} else {
+				emit(R_STORE, a, to_reg(ax, home(stack.size() + 1)));
+			}
+		}
+	}
+
+	void binary(int code) // stack (top) <op> ax, and pop out
+	{
+		auto b = ax;
+		auto a = pop();
+		int r = home(stack.size());
+		int ra = to_reg(a, r);
+		if (b.kind == reg_operand::imm) {
+			emit(code + (R_ADDI - R_ADD), r, ra, b.v);
+		} else {
+			emit(code, r, ra, to_reg(b, home(stack.size() + 1)));
+		}
+		ax = { reg_operand::reg, r };
+	}
+
+	void unary(int code)
+	{
+		int r = home(stack.size());
+		emit(code, r, to_reg(ax, r));
+		ax = { reg_operand::reg, r };
+	}
+
+	void call(int code, int a, size_t target, int pop_count)
+	{
+		spill_stack();
+		int sp = -frame - static_cast<int>(stack.size());
+		if (code == R_CALL) {
+			emit(R_CALL, 0, sp);
+			fixups.push_back(make_pair(reg_code.size() - 3, target));
+		} else {
+			emit(code, a, sp);
+		}
+		for (int i = 0; i < pop_count; ++i) pop();
+		ax = { reg_operand::acc, 0 };
+	}
+
+	void wide(const assembly_code& e) // run by run_wide() on the stack in memory, as the stack machine does
+	{
+		bool ok;
+		int effect = stack_effect(e, ok);
+		spill_stack();
+		to_ax();
+		emit(R_WIDE, e.code, e.param, -frame - static_cast<int>(stack.size()));
+		if (effect < 0) stack.resize(stack.size() + effect);
+		for (size_t i = 0; i < stack.size(); ++i) stack[i] = { reg_operand::reg, home(i) };
+		for (int i = 0; i < effect; ++i) stack.push_back({ reg_operand::reg, home(stack.size()) });
+	}
+
+	void sync(bool ax_dead) // at a jump, or a jump target, where all values must be at their home
+	{
+		spill_stack();
+		if (!ax_dead) to_ax();
+		ax = { reg_operand::acc, 0 };
+	}
+
+	void unreachable() // state of code after an unconditional transfer
+	{
+		for (size_t i = 0; i < stack.size(); ++i) stack[i] = { reg_operand::reg, home(i) };
+		ax = { reg_operand::acc, 0 };
+	}
+};
+
+int reg_binary_instruction(int code)
+{
+	switch (code) {
+	case ADD: return R_ADD; case SUB: return R_SUB; case MUL: return R_MUL;
+	case DIV: return R_DIV; case MOD: return R_MOD; case SHL: return R_SHL;
+	case SHR: return R_SHR; case AND: return R_AND; case OR:  return R_OR;
+	case EQ:  return R_EQ;  case NE:  return R_NE;  case GE:  return R_GE;
+	case GT:  return R_GT;  case LE:  return R_LE;  case LT:  return R_LT;
+	case LAND: return R_LAND; case LOR: return R_LOR;
+	case ADDI: return R_ADD; case SUBI: return R_SUB; case MULI: return R_MUL;
+	case EQI: return R_EQ; case NEI: return R_NE; case GEI: return R_GE;
+	case GTI: return R_GT; case LEI: return R_LE; case LTI: return R_LT;
+	default: return R_INVALID;
+	}
+}
+
+int reg_unary_instruction(int code)
+{
+	switch (code) {
+	case NEG: return R_NEG; case INC: return R_INC; case DEC: return R_DEC;
+	case NOT: return R_NOT; case LNOT: return R_LNOT;
+	default: return R_INVALID;
+	}
+}
+
+void translate_to_reg()
+{
+	read_image();
+	auto a = decode_code();
+	auto targets = jump_targets(a);
+	unordered_map<size_t, int> code_at; // offset => instruction
+	for (const auto& e : a) code_at.insert(make_pair(e.origin, e.code));
+	auto ax_dead_at = [&](size_t target) {
+		int code = code_at[target];
+		return instruction_sets_ax(code) || code == ENTER;
+	};
+
+	reg_code.clear();
+	reg_comments.clear();
+	reg_offset.clear();
+	unordered_map<size_t, size_t> label; // offset in code_sec => offset in reg_code
+	reg_translator t;
+	for (const auto& e : a) {
+		if (targets.find(e.origin) != targets.end()) {
+			t.sync(ax_dead_at(e.origin));
+		}
+		label.insert(make_pair(e.origin, reg_code.size()));
+		reg_offset.push_back(make_pair(e.origin, reg_code.size()));
+		size_t size = reg_code.size();
+
+		bool ok;
+		switch (e.code) {
+		case EXIT: t.to_ax(); t.emit(R_EXIT); t.unreachable(); break;
+		case PUSH: t.push(); break;
+		case POP:  t.ax = t.pop(); break;
+		case ADJ:  for (int i = 0; i < e.param; ++i) t.pop(); break;
+		case MOV: case LEA: t.ax = { reg_operand::imm, e.param }; break;
+		case GET:
+			t.emit(R_GET, t.home(t.stack.size()), e.param);
+			t.ax = { reg_operand::reg, t.home(t.stack.size()) };
+			break;
+		case PUT:  t.store_global(e.param); break;
+		case LLEA: t.ax = { reg_operand::laddr, e.param }; break;
+		case LGET: t.ax = { reg_operand::reg, e.param }; break;
+		case LPUT: t.store_local(e.param); break;
+		case SGET: t.load(t.pop()); break;
+		case SPUT: { t.spill_locals(0, true); auto addr = t.pop(); t.store(addr); break; }
+		case ENTER:
+			t.frame = e.param;
+			t.stack.clear();
+			t.ax = { reg_operand::acc, 0 };
+			t.emit(R_ENTER, e.param);
+			break;
+		case LEAVE: t.to_ax(); t.emit(R_LEAVE); break;
+		case RET:   t.emit(R_RET, e.param); t.unreachable(); break;
+		case CALL:  t.call(R_CALL, 0, e.param, -stack_effect(e, ok)); break;
+		case CALLX: t.call(R_CALLX, e.param, 0, natives[e.param].pop); break;
+		case TAILCALL: t.call(R_TAILCALL, e.param, 0, e.param); break;
+		case JMP:
+			t.sync(ax_dead_at(e.param));
+			t.emit_jump(R_JMP, 0, e.param);
+			t.unreachable();
+			break;
+		case JZ: case JNZ:
+			t.spill_stack();
+			if (t.ax.kind == reg_operand::reg) {
+				t.emit_jump(e.code == JZ ? R_JZR : R_JNZR, t.ax.v, e.param);
+			} else {
+				t.to_ax();
+				t.emit_jump(e.code == JZ ? R_JZ : R_JNZ, 0, e.param);
+			}
+			break;
+		case LGETPUSH: t.ax = { reg_operand::reg, e.param }; t.push(); break;
+		case PUSHI:    t.ax = { reg_operand::imm, e.param }; t.push(); break;
+		default:
+			if (e.code >= ADDI && e.code <= LTI) { // PUSH; MOV k; <op>
+				t.push();
+				t.ax = { reg_operand::imm, e.param };
+				t.binary(reg_binary_instruction(e.code));
+			} else if (reg_binary_instruction(e.code) != R_INVALID) {
+				t.binary(reg_binary_instruction(e.code));
+			} else if (reg_unary_instruction(e.code) != R_INVALID) {
+				t.unary(reg_unary_instruction(e.code));
+			} else if (instruction_is_wide(e.code)) {
+				t.wide(e);
+			} else {
+				err("register backend: unsupported instruction '%s'!\n",
+						(e.code >= 0 && e.code < INVALID ? instruction_name[e.code] : "?"));
+				exit(1);
+			}
+			break;
+		}
+		if (!e.comment.empty() && reg_code.size() > size) {
+			reg_comments.insert(make_pair(reg_code.size() - REG_CODE_SIZE, e.comment));
+		}
+	}
+	reg_exit_addr = reg_code.size();
+	t.emit(R_EXIT);
+
+	for (auto e : t.fixups) {
+		reg_code[e.first] = label[e.second];
+	}
+	log<1>("[DEBUG] register backend: %zd => %zd instruction(s)\n", a.size(), reg_code.size() / REG_CODE_SIZE);
+}
+
+size_t reg_code_offset(size_t offset) // offset of the first register instruction translated from code_sec[offset, ...)
+{
+	auto it = lower_bound(reg_offset.begin(), reg_offset.end(), make_pair(offset, size_t(0)));
+	return (it == reg_offset.end() ? reg_exit_addr : it->second);
+}
+
+int show_reg()
+{
+	translate_to_reg();
+	for (size_t i = 0; i < src.size(); ++i) {
+		print_source_code_line(i);
+		auto it = offset.find(i + 1);
+		if (it != offset.end()) {
+			log(COLOR_BLUE);
+			for (size_t j = reg_code_offset(it->second.first); j < reg_code_offset(it->second.second + 1);) {
+				j = print_reg_code(j);
+			}
+			log(COLOR_NORMAL);
+		}
+	}
+	return 0;
+}
+
+int show()
+{
+	read_image();
+	if (verbose >= 1) {
+		for (size_t i = 0; i < external_code_size;) {
+			i = print_code(code_sec.data(), i);
+		}
+	}
+	for (size_t i = 0; i < src.size(); ++i) {
+		print_source_code_line(i);
+		auto it = offset.find(i + 1);
+		if (it != offset.end()) {
+			log(COLOR_BLUE);
+			for (size_t j = it->second.first; j <= it->second.second;) {
+				j = print_code(code_sec.data(), j);
+			}
+			log(COLOR_NORMAL);
+		}
+	}
+	log("\n");
+
+	for (size_t i = (verbose >= 1 ? 0 : external_data_size); i < data_sec.size(); ++i) {
+		auto it = data_symbol_dict.find(i);
+		if (it != data_symbol_dict.end()) {
+			auto name = symbols[it->second].name;
+			auto [ is_code, offset, size, type, ret_type, arg_count, depth ] = global_symbol(it->second);
+			string data_type = "word";
+			bool is_string = (type == type_of("const char*"));
+			if (is_string) data_type = "byte";
+			log(COLOR_YELLOW "%-10zd", i);
+			log(COLOR_BLUE ".%-13s", data_type.c_str());
+			size_t width = 0;
+			if (is_string) {
+				log("\""); ++width;
+				const char* s = reinterpret_cast<const char*>(&data_sec[offset]);
+				for (size_t i = 0; i + 1 < size * sizeof(int); ++i) {
+					switch (s[i]) {
+						default: log("%c", s[i]); ++width; break;
+						case '\t': log("\\t"); width += 2; break;
+						case '\r': log("\\r"); width += 2; break;
+						case '\n': log("\\n"); width += 2; break;
+						case '\\': log("\\\\"); width += 2; break;
+						case '\'': log("\\\'"); width += 2; break;
+						case '\"': log("\\\""); width += 2; break;
+						case '\0': log("\\0"); width += 2; break;
+					}
+				}
+				log("\""); ++width;
+			} else {
+				for (size_t i = 0; i < size; ++i) {
+					if (i > 0) { log("  "); width += 2; }
+					log("0x%08X", static_cast<unsigned int>(data_sec[offset + i]));
+					width += 10;
+				}
+			}
+			if (width > 25) {
+				log("\n%*s", (10 + 14 + 25), "");
+			} else {
+				log("%*s", 25 - width, "");
+			}
+			log(" ; %s %s" COLOR_NORMAL "\n", type->name.c_str(), name.c_str());
+		}
+	}
+	return 0;
+}
+
+void print_vm_env(int ax, int ip, int sp, int bp)
+{
+	const int top = static_cast<int>(m.size());
+	log("\tax = %08X, ip = %08X, sp = %08X, bp = %08X\n", ax, ip, sp, bp);
+	log("\t[stack]: ");
+	size_t i = 0;
+	for (; i < 6 && sp + static_cast<int>(i) < top; ++i) {
+		if (i > 0) { log(", "); }
+		log("0x%08X", m[sp + i]);
+	}
+	if (sp + static_cast<int>(i) < top) {
+		log(", ...");
+	}
+	log("\n");
+	for (size_t i = 0; i < 10 && bp != top; ++i) {
+		log("\t[#%zd backtrace]: bp = %08X", i, bp);
+		if (bp == m[bp]) break;
+		log("\tm[bp] = %08X", m[bp]);
+		log("\tm[bp+1] = %08X", m[bp+1]);
+		log("\tm[bp+2] = %08X", m[bp+2]);
+		log("\tm[bp+3] = %08X", m[bp+3]);
+		log("\tm[bp+4] = %08X", m[bp+4]);
+		bp = m[bp];
+		log("\n");
+	}
+	if (i == 10) {
+		log("...\n");
+	}
+	log("\n");
+	return;
+}
+
+size_t load_program() // load data & code into memory, and return the code loading position
+{
+	if (!m.map && !m.allocate(opt_mem_size, opt_stack_size)) {
+		err("failed to reserve %zd byte(s) of vm memory with a %zd byte(s) stack!\n", opt_mem_size, opt_stack_size);
+		return 0;
+	}
+	if (data_sec_size() + code_sec_size() + 1 > m.limit()) {
+		err("program too large for vm memory (%zd word(s) of data & code, %zd available)!\n",
+				data_sec_size() + code_sec_size() + 1, m.limit());
+		return 0;
+	}
+	log<1>("Loading program\n  data: %zd word(s)\n  code: %zd word(s)\n\n",
+			data_sec_size(), code_sec_size());
+
+	size_t code_loading_position = data_sec_size();
+	size_t loaded = code_loading_position + code_sec_size();
+	if (vm.image_fd < 0 || !m.map_image(vm.image_fd, vm.image_offset, loaded + 1)) {
+		if (!read_image()) return 0;
+		memcpy(m.data(), data_sec.data(), data_sec.size() * sizeof(int));
+		memcpy(m.data() + code_loading_position, code_sec.data(), code_sec.size() * sizeof(int));
+		m[loaded] = EXIT; // main() returns here
+	}
+	if (vm.image_fd >= 0 && !vm.image_unread) { // else kept for read_image(), until reset_context()
+		close(vm.image_fd);
+		vm.image_fd = -1;
+	}
+	return code_loading_position;
+}
+
+int find_main() // offset of main() in code_sec
+{
+	const auto& overloads = symbols[symbol_id("main")].overloads;
+	if (overloads.empty()) {
+		err("main() not defined!\n");
+		return -1;
+	}
+	if (overloads.size() > 1) {
+		err("duplcated definition of main()!\n");
+		return -1;
+	}
+	return global_symbol(overloads[0]).offset;
+}
+
+void prepare_stack(int argc, const char** argv, int ip, int exit_addr, int& sp, int& bp)
+{
+	const int top = static_cast<int>(m.size());
+	sp = bp = top;
+
+	// prepare argc & argv
+	sp -= argc + 1;
+	int argv_copy = sp;
+	for (int i = 0; i < argc; ++i) {
+		size_t len = strlen(argv[i]);
+		size_t size = (len + sizeof(int)) / sizeof(int);
+		m[sp - 1] = 0;
+		sp -= size;
+		m[argv_copy + i] = sp;
+		memcpy(&m[sp], argv[i], len);
+	}
+	m[argv_copy + argc] = 0;
+	if (verbose >= 3) {
+		log("[DEBUG] prepare argc & argv:\n");
+		for (int i = sp; i < top; i += 4) {
+			log("[DEBUG] %08X:  ", i);
+			for (int j = 0; j < 4; ++j) {
+				if (i + j < top) {
 					const unsigned char* p = reinterpret_cast<const unsigned char*>(&m[i + j]);
 					log("%02X %02X %02X %02X  ", *p, *(p+1), *(p+2), *(p+3));
 				} else {
 					log("%*s", 13, "");
 				}
 			}
-			for (int j = 0; j < 4 && i + j < MEM_SIZE; ++j) {
+			for (int j = 0; j < 4 && i + j < top; ++j) {
 				const char* p = reinterpret_cast<const char*>(&m[i + j]);
 				for (int k = 0; k < 4; ++k) {
 					char c = *(p+k);
@@ -1680,118 +3794,1743 @@ int run(int argc, const char** argv)
 			}
 			log("\n");
 		}
-		log("[DEBUG] argv_copy = 0x%08X\n\n", argv_copy);
+		log("[DEBUG] argv_copy = 0x%08X\n\n", argv_copy);
+	}
+
+	// prepare stack for main()
+	bp = sp - 1;
+	m[--sp] = bp;
+	m[--sp] = argc;
+	m[--sp] = argv_copy;
+	m[--sp] = exit_addr;
+	if (verbose >= 3) {
+		log("[DEBUG] stack for main():\n");
+		log("[DEBUG] stack: m[sp]... = [ %08X, %08X, %08X, %08X, %08X ]\n", m[sp], m[sp+1], m[sp+2], m[sp+3], m[sp+4]);
+		log("[DEBUG] ip = %08X, bp = %08X, sp = %08X\n\n", ip, bp, sp);
+	}
+
+	log<1>("System Information:\n"
+			"  sizeof(int) = %zd\n"
+			"  sizeof(void*) = %zd\n"
+			"\n", sizeof(int), sizeof(void*));
+}
+
+//--------------------------------------------------------//
+// jit compiler
+//
+// functions called JIT_THRESHOLD times by run() are compiled to x86-64 code,
+// working on the same m/ax/sp/bp (rbx = &m[0], r12d = ax, r13d = sp,
+// r14d = bp, r15 = cycle, rbp = jit_state). run() enters it at any compiled
+// instruction; CALL/RET jump straight into other compiled code, or leave to
+// run() with the guest ip to continue at.
+
+#ifdef ICPP_JIT
+#include <cstddef>
+
+const int JIT_THRESHOLD = 16;
+
+int jit_call_native(int sp, native_handler handler); // call_native(), for compiled code
+
+struct jit_state {
+	int ax, sp, bp;
+	size_t cycle;
+};
+
+enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+	R_AX = 12, R_SP = 13, R_BP = 14, R_CYCLE = 15 };
+enum { CC_E = 0x4, CC_NE = 0x5, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF };
+
+struct jit_asm {
+	vector<unsigned char> b;
+
+	void byte(int v) { b.push_back(static_cast<unsigned char>(v)); }
+	void imm32(int v) { for (int i = 0; i < 4; ++i) byte(v >> (i * 8)); }
+	void imm64(const void* p) { uint64_t v = reinterpret_cast<uint64_t>(p); for (int i = 0; i < 8; ++i) byte(v >> (i * 8)); }
+	void rex(bool w, int reg, int index, int rm) {
+		int r = 0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((index & 8) ? 2 : 0) | ((rm & 8) ? 1 : 0);
+		if (r != 0x40) byte(r);
+	}
+	void opcode(int op) { if (op > 0xFF) byte(op >> 8); byte(op); }
+
+	void op_rr(int op, int reg, int rm, bool w = false) { // op reg, rm (registers)
+		rex(w, reg, 0, rm); opcode(op); byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+	}
+	void op_r(int op, int ext, int rm) { op_rr(op, ext, rm); } // op /ext rm
+	void op_ri(int ext, int rm, int v) { op_rr(0x81, ext, rm); imm32(v); } // op /ext rm, imm32
+	void op_mem(int op, int reg, int index, int disp) { // op reg, [rbx + index * 4 + disp]
+		rex(false, reg, index, RBX); opcode(op);
+		if (disp == 0) {
+			byte(0x04 | ((reg & 7) << 3)); byte(0x80 | ((index & 7) << 3) | RBX);
+		} else if (disp >= -128 && disp < 128) {
+			byte(0x44 | ((reg & 7) << 3)); byte(0x80 | ((index & 7) << 3) | RBX); byte(disp);
+		} else {
+			byte(0x84 | ((reg & 7) << 3)); byte(0x80 | ((index & 7) << 3) | RBX); imm32(disp);
+		}
+	}
+	void op_abs(int op, int reg, int disp) { // op reg, [rbx + disp]
+		rex(false, reg, 0, RBX); opcode(op); byte(0x80 | ((reg & 7) << 3) | RBX); imm32(disp);
+	}
+	void op_state(int op, int reg, int disp, bool w = false) { // op reg, [rbp + disp8]
+		rex(w, reg, 0, RBP); opcode(op); byte(0x40 | ((reg & 7) << 3) | RBP); byte(disp);
+	}
+	void mov_ri(int reg, int v) { rex(false, 0, 0, reg); byte(0xB8 | (reg & 7)); imm32(v); }
+	void mov_rp(int reg, const void* p) { rex(true, 0, 0, reg); byte(0xB8 | (reg & 7)); imm64(p); }
+
+	size_t rel8(int op) { byte(op); byte(0); return b.size(); } // short jump, to be patched by here()
+	void here(size_t at) { b[at - 1] = static_cast<unsigned char>(b.size() - at); }
+	size_t rel32(int op) { opcode(op); imm32(0); return b.size(); } // near jump, to be patched by link()
+	void link(size_t at, size_t target) { int d = static_cast<int>(target - at); memcpy(&b[at - 4], &d, 4); }
+
+	void count() { op_rr(0xFF, 0, R_CYCLE, true); } // inc r15
+	void push_ax() { op_r(0xFF, 1, R_SP); op_mem(0x89, R_AX, R_SP, 0); }
+	void pop(int reg) { op_mem(0x8B, reg, R_SP, 0); op_r(0xFF, 0, R_SP); }
+	void set_ax(int cc) { byte(0x0F); byte(0x90 | cc); byte(0xC0); byte(0x44); byte(0x0F); byte(0xB6); byte(0xE0); } // setcc al; movzx r12d, al
+};
+
+const void* jit_load(const jit_asm& a) // copy code to executable memory
+{
+	size_t size = (a.b.size() + 4095) / 4096 * 4096;
+	void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) return nullptr;
+	memcpy(p, a.b.data(), a.b.size());
+	if (mprotect(p, size, PROT_READ | PROT_EXEC) != 0) {
+		munmap(p, size);
+		return nullptr;
+	}
+	vm.jit_buffers.push_back(make_pair(p, size));
+	return p;
+}
+
+void jit_release()
+{
+	for (auto& e : vm.jit_buffers) munmap(e.first, e.second);
+	vm.jit_buffers.clear();
+}
+
+bool jit_init(size_t loaded)
+{
+	jit_asm a;
+	a.byte(0x53); a.byte(0x55); // push rbx; push rbp
+	for (int r = R_AX; r <= R_CYCLE; ++r) { a.rex(false, 0, 0, r); a.byte(0x50 | (r & 7)); } // push r12-r15
+	a.byte(0x48); a.byte(0x83); a.byte(0xEC); a.byte(0x08); // sub rsp, 8 (keep rsp aligned for natives)
+	a.op_rr(0x89, RDI, RBP, true); // mov rbp, rdi
+	a.mov_rp(RBX, m.data());
+	a.op_state(0x8B, R_AX, offsetof(jit_state, ax));
+	a.op_state(0x8B, R_SP, offsetof(jit_state, sp));
+	a.op_state(0x8B, R_BP, offsetof(jit_state, bp));
+	a.op_state(0x8B, R_CYCLE, offsetof(jit_state, cycle), true);
+	a.op_r(0xFF, 4, RSI); // jmp rsi
+	size_t leave = a.b.size();
+	a.op_state(0x89, R_AX, offsetof(jit_state, ax));
+	a.op_state(0x89, R_SP, offsetof(jit_state, sp));
+	a.op_state(0x89, R_BP, offsetof(jit_state, bp));
+	a.op_state(0x89, R_CYCLE, offsetof(jit_state, cycle), true);
+	a.byte(0x48); a.byte(0x83); a.byte(0xC4); a.byte(0x08); // add rsp, 8
+	for (int r = R_CYCLE; r >= R_AX; --r) { a.rex(false, 0, 0, r); a.byte(0x58 | (r & 7)); } // pop r15-r12
+	a.byte(0x5D); a.byte(0x5B); a.byte(0xC3); // pop rbp; pop rbx; ret
+
+	const void* p = jit_load(a);
+	if (!p) return false;
+	jit_enter = reinterpret_cast<jit_entry>(const_cast<void*>(p));
+	jit_leave = static_cast<const char*>(p) + leave;
+	jit_addr.assign(loaded, nullptr);
+	jit_calls.assign(loaded, 0);
+	return true;
+}
+
+// compile the function starting at guest ip 'start', and patch 'decoded' (of
+// run()) to enter it via 'op_jit'
+void jit_compile(size_t start, size_t code_loading_position, vector<const void*>& decoded, const void* op_jit)
+{
+	size_t end = code_loading_position + code_sec_size();
+	for (auto& e : code_symbol_dict) {
+		size_t ip = code_loading_position + e.first;
+		if (ip > start && ip < end) end = ip;
+	}
+
+	jit_asm a;
+	unordered_map<size_t, size_t> host; // guest ip => offset in a.b
+	vector<pair<size_t, size_t>> fixups; // [ { at, guest ip } ]
+	vector<size_t> exits; // near jumps to the exit stub
+	auto exit_with = [&](size_t ip) { a.mov_ri(RAX, ip); exits.push_back(a.rel32(0xE9)); };
+	auto jump_to = [&](size_t target) { // jmp to compiled code, or false
+		if (target >= start && target < end) {
+			fixups.push_back(make_pair(a.rel32(0xE9), target));
+		} else if (jit_addr[target]) {
+			a.mov_rp(RAX, jit_addr[target]); a.op_r(0xFF, 4, RAX); // jmp rax
+		} else {
+			return false;
+		}
+		return true;
+	};
+
+	vector<size_t> entries;
+	for (size_t ip = start; ip < end; ) {
+		int code = m[ip];
+		int param = instruction_has_parameter(code) ? m[ip + 1] : 0;
+		size_t next = ip + (instruction_has_parameter(code) ? 2 : 1);
+		host[ip] = a.b.size();
+		if (code != CALL && code >= 0 && code < INVALID && code != EXIT && !instruction_is_wide(code)) {
+			entries.push_back(ip);
+			a.count();
+		}
+		switch (code) {
+		case PUSH: a.push_ax(); break;
+		case POP: a.pop(R_AX); break;
+		case ADJ: a.op_ri(0, R_SP, param); break;
+
+		case MOV: case LEA: a.mov_ri(R_AX, param); break;
+		case GET: a.op_abs(0x8B, R_AX, param * 4); break;
+		case PUT: a.op_abs(0x89, R_AX, param * 4); break;
+		case LLEA: a.op_rr(0x89, R_BP, R_AX); a.op_ri(0, R_AX, param); break;
+		case LGET: a.op_mem(0x8B, R_AX, R_BP, param * 4); break;
+		case LPUT: a.op_mem(0x89, R_AX, R_BP, param * 4); break;
+
+		case SGET: a.pop(RAX); a.op_mem(0x8B, R_AX, RAX, 0); break;
+		case SPUT: a.pop(RAX); a.op_mem(0x89, R_AX, RAX, 0); break;
+
+		case ADD: a.pop(RAX); a.op_rr(0x01, R_AX, RAX); a.op_rr(0x89, RAX, R_AX); break;
+		case SUB: a.pop(RAX); a.op_rr(0x29, R_AX, RAX); a.op_rr(0x89, RAX, R_AX); break;
+		case MUL: a.pop(RAX); a.op_rr(0x0FAF, RAX, R_AX); a.op_rr(0x89, RAX, R_AX); break;
+		case DIV: a.pop(RAX); a.byte(0x99); a.op_r(0xF7, 7, R_AX); a.op_rr(0x89, RAX, R_AX); break;
+		case MOD: a.pop(RAX); a.byte(0x99); a.op_r(0xF7, 7, R_AX); a.op_rr(0x89, RDX, R_AX); break;
+		case NEG: a.op_r(0xF7, 3, R_AX); break;
+		case INC: a.op_r(0xFF, 0, R_AX); break;
+		case DEC: a.op_r(0xFF, 1, R_AX); break;
+
+		case SHL: a.pop(RAX); a.op_rr(0x89, R_AX, RCX); a.op_r(0xD3, 7, RAX); a.op_rr(0x89, RAX, R_AX); break; // >>
+		case SHR: a.pop(RAX); a.op_rr(0x89, R_AX, RCX); a.op_r(0xD3, 4, RAX); a.op_rr(0x89, RAX, R_AX); break; // <<
+		case AND: a.pop(RAX); a.op_rr(0x21, R_AX, RAX); a.op_rr(0x89, RAX, R_AX); break;
+		case OR: a.pop(RAX); a.op_rr(0x09, R_AX, RAX); a.op_rr(0x89, RAX, R_AX); break;
+		case NOT: a.op_r(0xF7, 2, R_AX); break;
+
+		case EQ: a.pop(RAX); a.op_rr(0x39, R_AX, RAX); a.set_ax(CC_E); break;
+		case NE: a.pop(RAX); a.op_rr(0x39, R_AX, RAX); a.set_ax(CC_NE); break;
+		case GE: a.pop(RAX); a.op_rr(0x39, R_AX, RAX); a.set_ax(CC_GE); break;
+		case GT: a.pop(RAX); a.op_rr(0x39, R_AX, RAX); a.set_ax(CC_G); break;
+		case LE: a.pop(RAX); a.op_rr(0x39, R_AX, RAX); a.set_ax(CC_LE); break;
+		case LT: a.pop(RAX); a.op_rr(0x39, R_AX, RAX); a.set_ax(CC_L); break;
+		case LAND:
+			a.pop(RAX);
+			a.op_rr(0x85, RAX, RAX); a.byte(0x0F); a.byte(0x95); a.byte(0xC1); // setne cl
+			a.op_rr(0x85, R_AX, R_AX); a.byte(0x0F); a.byte(0x95); a.byte(0xC0); // setne al
+			a.byte(0x20); a.byte(0xC8); // and al, cl
+			a.byte(0x44); a.byte(0x0F); a.byte(0xB6); a.byte(0xE0); // movzx r12d, al
+			break;
+		case LOR: a.pop(RAX); a.op_rr(0x09, R_AX, RAX); a.set_ax(CC_NE); break;
+		case LNOT: a.op_rr(0x85, R_AX, R_AX); a.set_ax(CC_E); break;
+
+		case ENTER: {
+			a.op_rr(0x89, R_SP, RAX); a.op_ri(5, RAX, param + 1); a.op_ri(7, RAX, m.stack_base()); // sp - 1 - param >= stack base?
+			size_t fits = a.rel8(0x7D); // jge
+			exit_with(-1); // no guest ip, for run() to raise the stack overflow
+			a.here(fits);
+			a.op_r(0xFF, 1, R_SP); a.op_mem(0x89, R_BP, R_SP, 0);
+			a.op_rr(0x89, R_SP, R_BP); a.op_ri(5, R_SP, param);
+			break;
+		}
+		case LEAVE: a.op_rr(0x89, R_BP, R_SP); a.pop(R_BP); break;
+		case CALL: {
+			size_t target = next + param;
+			size_t to_call = 0;
+			if (!(target >= start && target < end) && !jit_addr[target]) { // not compiled (yet), look it up at runtime
+				a.mov_rp(RAX, &jit_addr[target]);
+				a.byte(0x48); a.byte(0x8B); a.byte(0x00); // mov rax, [rax]
+				a.op_rr(0x85, RAX, RAX, true);
+				to_call = a.rel8(0x75); // jnz
+				exit_with(ip); // let run() do the call
+				a.here(to_call);
+			}
+			a.count();
+			a.op_r(0xFF, 1, R_SP); a.op_mem(0xC7, 0, R_SP, 0); a.imm32(next); // push return address
+			if (to_call || !jump_to(target)) a.op_r(0xFF, 4, RAX);
+			break;
+		}
+		case RET: {
+			a.pop(RCX);
+			if (param) a.op_ri(0, R_SP, param);
+			a.mov_rp(RAX, jit_addr.data());
+			a.byte(0x48); a.byte(0x8B); a.byte(0x04); a.byte(0xC8); // mov rax, [rax + rcx * 8]
+			a.op_rr(0x85, RAX, RAX, true);
+			size_t to_run = a.rel8(0x74); // jz
+			a.op_r(0xFF, 4, RAX);
+			a.here(to_run);
+			a.op_rr(0x89, RCX, RAX); // return address is not compiled, continue in run()
+			exits.push_back(a.rel32(0xE9));
+			break;
+		}
+		case TAILCALL:
+			for (int i = 0; i < param; ++i) {
+				a.op_mem(0x8B, RAX, R_SP, i * 4);
+				a.op_mem(0x89, RAX, R_BP, (2 + i) * 4);
+			}
+			a.op_rr(0x89, R_BP, R_SP); a.op_r(0xFF, 0, R_SP); // sp = bp + 1
+			a.op_mem(0x8B, R_BP, R_BP, 0);
+			break;
+		case JMP: if (!jump_to(next + param)) exit_with(next + param); break;
+		case JZ: case JNZ:
+			a.op_rr(0x85, R_AX, R_AX);
+			if (next + param >= start && next + param < end) {
+				fixups.push_back(make_pair(a.rel32(code == JZ ? 0x0F84 : 0x0F85), next + param));
+			} else {
+				size_t skip = a.rel8(code == JZ ? 0x75 : 0x74);
+				exit_with(next + param);
+				a.here(skip);
+			}
+			break;
+
+		case CALLX: {
+			const native_function& f = natives[param];
+			a.op_rr(0x89, R_SP, RDI);
+			a.mov_rp(RSI, reinterpret_cast<const void*>(f.handler));
+			a.mov_rp(RAX, reinterpret_cast<const void*>(jit_call_native));
+			a.op_r(0xFF, 2, RAX); // call rax
+			a.op_rr(0x89, RAX, R_AX);
+			if (f.pop) a.op_ri(0, R_SP, f.pop);
+			break;
+		}
+
+		case LGETPUSH: a.op_mem(0x8B, R_AX, R_BP, param * 4); a.push_ax(); break;
+		case PUSHI: a.mov_ri(R_AX, param); a.push_ax(); break;
+		case ADDI: a.op_ri(0, R_AX, param); break;
+		case SUBI: a.op_ri(5, R_AX, param); break;
+		case MULI: a.op_rr(0x69, R_AX, R_AX); a.imm32(param); break;
+		case EQI: a.op_ri(7, R_AX, param); a.set_ax(CC_E); break;
+		case NEI: a.op_ri(7, R_AX, param); a.set_ax(CC_NE); break;
+		case GEI: a.op_ri(7, R_AX, param); a.set_ax(CC_GE); break;
+		case GTI: a.op_ri(7, R_AX, param); a.set_ax(CC_G); break;
+		case LEI: a.op_ri(7, R_AX, param); a.set_ax(CC_LE); break;
+		case LTI: a.op_ri(7, R_AX, param); a.set_ax(CC_L); break;
+
+		default: exit_with(ip); break; // EXIT, and anything unknown, is left to run()
+		}
+		ip = next;
+	}
+	exit_with(end); // falling off the end of the function
+
+	size_t exit_stub = a.b.size();
+	a.mov_rp(RDX, jit_leave);
+	a.op_r(0xFF, 4, RDX); // jmp rdx
+	for (auto at : exits) a.link(at, exit_stub);
+	for (auto& e : fixups) {
+		auto it = host.find(e.second);
+		if (it == host.end()) {
+			log<1>("[JIT] jump into the middle of an instruction at %zd\n", e.second);
+			return;
+		}
+		a.link(e.first, it->second);
+	}
+
+	const char* p = static_cast<const char*>(jit_load(a));
+	if (!p) return;
+	for (auto ip : entries) {
+		jit_addr[ip] = p + host[ip];
+		decoded[ip] = op_jit;
+	}
+}
+#endif
+
+//--------------------------------------------------------//
+// wide arithmetic
+//
+// 'long long' and 'double' values live on the stack as two words, and wide
+// instructions are run here by every engine: binary ones pop the top two
+// values and push the result, comparisons pop both into ax, and conversions
+// work in place at [sp + param] (I2L/I2D with param 0 push ax instead).
+
+#define WIDE_BINARY(code, T, op) \
+	case code: wide_put<T>(m + sp + 2, wide_get<T>(m + sp + 2) op wide_get<T>(m + sp)); sp += 2; break;
+#define WIDE_COMPARE(code, T, op) \
+	case code: ax = (wide_get<T>(m + sp + 2) op wide_get<T>(m + sp)); sp += 4; break;
+
+inline int run_wide(int code, int param, int* m, int sp, int bp, int& ax) // returns the new sp
+{
+	switch (code) {
+	case WGET:  sp -= 2; m[sp] = m[param]; m[sp + 1] = m[param + 1]; break;
+	case WPUT:  m[param] = m[sp]; m[param + 1] = m[sp + 1]; break;
+	case WLGET: sp -= 2; m[sp] = m[bp + param]; m[sp + 1] = m[bp + param + 1]; break;
+	case WLPUT: m[bp + param] = m[sp]; m[bp + param + 1] = m[sp + 1]; break;
+
+	WIDE_BINARY(LADD, unsigned long long, +) // wrap around, as int does in the vm
+	WIDE_BINARY(LSUB, unsigned long long, -)
+	WIDE_BINARY(LMUL, unsigned long long, *)
+	WIDE_BINARY(LDIV, long long, /)
+	WIDE_BINARY(LMOD, long long, %)
+	WIDE_COMPARE(LEQ, long long, ==)
+	WIDE_COMPARE(LNE, long long, !=)
+	WIDE_COMPARE(LGE, long long, >=)
+	WIDE_COMPARE(LGT, long long, >)
+	WIDE_COMPARE(LLE, long long, <=)
+	WIDE_COMPARE(LLT, long long, <)
+
+	WIDE_BINARY(DADD, double, +)
+	WIDE_BINARY(DSUB, double, -)
+	WIDE_BINARY(DMUL, double, *)
+	WIDE_BINARY(DDIV, double, /)
+	WIDE_COMPARE(DEQ, double, ==)
+	WIDE_COMPARE(DNE, double, !=)
+	WIDE_COMPARE(DGE, double, >=)
+	WIDE_COMPARE(DGT, double, >)
+	WIDE_COMPARE(DLE, double, <=)
+	WIDE_COMPARE(DLT, double, <)
+
+	case I2L: case I2D: { // widen ax (param 0), or the int under the top value (param 2)
+		int v = (param == 0 ? ax : m[sp + param]);
+		if (param == 0) { sp -= 2; } else { memmove(m + sp - 1, m + sp, param * sizeof(int)); --sp; }
+		if (code == I2L) wide_put<long long>(m + sp + param, v); else wide_put<double>(m + sp + param, v);
+		break;
+	}
+	case L2D: wide_put<double>(m + sp + param, static_cast<double>(wide_get<long long>(m + sp + param))); break;
+	case D2L: wide_put<long long>(m + sp + param, static_cast<long long>(wide_get<double>(m + sp + param))); break;
+	case L2I: ax = static_cast<int>(wide_get<long long>(m + sp)); sp += 2; break;
+	case D2I: ax = static_cast<int>(wide_get<double>(m + sp)); sp += 2; break;
+	}
+	return sp;
+}
+
+#undef WIDE_BINARY
+#undef WIDE_COMPARE
+
+//--------------------------------------------------------//
+// execution policy
+//
+// the VM loops are templates over a policy, instantiated once per policy and
+// chosen in main(), so whatever a policy turns off is not compiled into its
+// loop at all.
+
+struct fast_policy {
+	static constexpr bool trace = false; // print every instruction (-v)
+	static constexpr bool profile = false; // count instructions, pairs of them, and code offsets (--profile-ops, --line-profile)
+	static constexpr bool jit = true; // compile hot functions, see "jit compiler"
+};
+
+struct trace_policy {
+	static constexpr bool trace = true;
+	static constexpr bool profile = false;
+	static constexpr bool jit = false; // tracing needs every instruction interpreted
+};
+
+struct profile_policy {
+	static constexpr bool trace = false;
+	static constexpr bool profile = true;
+	static constexpr bool jit = false; // so does profiling
+};
+
+// a fault in guest code (hitting a guard area of vm memory, or dividing by zero) is handled
+// by jumping back to execute(), over the frames of the VM loop and of compiled code. they
+// hold no objects to destroy, so nothing is skipped; native functions may, so they run with
+// the jump unset, and a fault in them crashes as usual. an error raised by a native called
+// from compiled code (err() in batch mode) can not unwind through it, so it is caught in
+// jit_call_native(), and leaves the same way, to be thrown again by execute().
+
+static thread_local sigjmp_buf* vm_fault_jump = nullptr; // set while guest code is running
+static thread_local const char* vm_fault_reason = nullptr;
+static thread_local exception_ptr vm_fault_error; // thrown by a native in compiled code
+
+void on_vm_fault(int sig, siginfo_t* info, void*)
+{
+	const char* reason = !vm_fault_jump ? nullptr
+		: sig == SIGFPE ? (info->si_code == FPE_INTDIV ? "divided by zero" : "arithmetic exception")
+		: vm.m.fault(info->si_addr);
+	if (!reason) { signal(sig, SIG_DFL); return; } // not a guard area, so crash as usual
+	vm_fault_reason = reason;
+	siglongjmp(*vm_fault_jump, 1);
+}
+
+void install_fault_handler()
+{
+	struct sigaction sa = {};
+	sa.sa_sigaction = on_vm_fault;
+	sa.sa_flags = SA_SIGINFO;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGSEGV, &sa, nullptr);
+	sigaction(SIGFPE, &sa, nullptr);
+}
+
+inline int call_native(const native_function& f, int sp)
+{
+	sigjmp_buf* jump = vm_fault_jump;
+	vm_fault_jump = nullptr;
+	int ax = f.handler(sp);
+	vm_fault_jump = jump;
+	return ax;
+}
+
+#ifdef ICPP_JIT
+int jit_call_native(int sp, native_handler handler)
+{
+	sigjmp_buf* jump = vm_fault_jump;
+	vm_fault_jump = nullptr;
+	int ax = 0;
+	try {
+		ax = handler(sp);
+	} catch (...) {
+		vm_fault_error = current_exception();
+	}
+	vm_fault_jump = jump;
+	if (vm_fault_error) siglongjmp(*jump, 1); // nothing with a destructor is left in this frame
+	return ax;
+}
+#endif
+
+//--------------------------------------------------------//
+// execution profile
+
+void print_profile(size_t cycle)
+{
+	const size_t TOP_PAIRS = 20;
+	vector<pair<size_t, int>> a;
+	for (int i = 0; i <= INVALID; ++i) {
+		if (profile_ops[i] > 0) a.push_back(make_pair(profile_ops[i], i));
+	}
+	sort(a.begin(), a.end(), [](const pair<size_t, int>& x, const pair<size_t, int>& y) {
+			return x.first > y.first || (x.first == y.first && x.second < y.second); });
+	log("Instruction profile:\n");
+	for (auto& e : a) {
+		log("  %-14s %12zd %7.2f%%\n", instruction_name[e.second], e.first, 100.0 * e.first / cycle);
+	}
+
+	a.clear();
+	for (int i = 0; i < (INVALID + 1) * (INVALID + 1); ++i) {
+		if (profile_pairs[i] > 0) a.push_back(make_pair(profile_pairs[i], i));
+	}
+	sort(a.begin(), a.end(), [](const pair<size_t, int>& x, const pair<size_t, int>& y) {
+			return x.first > y.first || (x.first == y.first && x.second < y.second); });
+	log("Instruction pair profile (top %zd of %zd):\n", min(a.size(), TOP_PAIRS), a.size());
+	for (size_t i = 0; i < a.size() && i < TOP_PAIRS; ++i) {
+		log("  %-14s %-14s %12zd %7.2f%%\n",
+				instruction_name[a[i].second / (INVALID + 1)], instruction_name[a[i].second % (INVALID + 1)],
+				a[i].first, 100.0 * a[i].first / cycle);
+	}
+}
+
+void print_line_profile(size_t cycle, size_t code_loading_position) // source listing, like show(), with cycles per line
+{
+	const size_t HOT_LINES = 5;
+	vector<size_t> lines(src.size());
+	for (size_t i = 0; i < src.size(); ++i) {
+		auto it = offset.find(i + 1);
+		if (it == offset.end()) continue;
+		for (size_t j = it->second.first; j <= it->second.second && j < code_sec_size(); ++j) {
+			lines[i] += profile_code[code_loading_position + j];
+		}
+	}
+	vector<size_t> sorted = lines;
+	sort(sorted.begin(), sorted.end(), greater<size_t>());
+	size_t hot = (sorted.empty() ? 0 : sorted[min(sorted.size(), HOT_LINES) - 1]);
+
+	log("Line profile:\n");
+	for (size_t i = 0; i < src.size(); ++i) {
+		if (lines[i] == 0) {
+			log("%21s ", "");
+			print_source_code_line(i);
+		} else if (lines[i] >= hot) {
+			log(COLOR_RED "%12zd %7.2f%% ", lines[i], 100.0 * lines[i] / cycle);
+			print_source_code_line(i);
+			log(COLOR_NORMAL);
+		} else {
+			log("%12zd %7.2f%% ", lines[i], 100.0 * lines[i] / cycle);
+			print_source_code_line(i);
+		}
+	}
+}
+
+bool dump_profile(const char* filename) // as csv: kind,prev,next,count
+{
+	ofstream file(filename);
+	if (!file.is_open()) {
+		warn("can not write profile to '%s'!\n", filename);
+		return false;
+	}
+	file << "kind,prev,next,count" << endl;
+	for (int i = 0; i <= INVALID; ++i) {
+		if (profile_ops[i] > 0) {
+			file << "op,," << instruction_name[i] << "," << profile_ops[i] << endl;
+		}
 	}
+	for (int i = 0; i < (INVALID + 1) * (INVALID + 1); ++i) {
+		if (profile_pairs[i] > 0) {
+			file << "pair," << instruction_name[i / (INVALID + 1)] << "," << instruction_name[i % (INVALID + 1)]
+				<< "," << profile_pairs[i] << endl;
+		}
+	}
+	return true;
+}
 
-	// prepare stack for main()
-	bp = sp - 1;
-	m[--sp] = bp;
-	m[--sp] = EXIT; int exit_addr = sp;
-	m[--sp] = argc;
-	m[--sp] = argv_copy;
-	m[--sp] = exit_addr;
-	if (verbose >= 3) {
-		log("[DEBUG] stack for main():\n");
-		log("[DEBUG] stack: m[sp]... = [ %08X, %08X, %08X, %08X, %08X ]\n", m[sp], m[sp+1], m[sp+2], m[sp+3], m[sp+4]);
-		log("[DEBUG] ax = %08X, ip = %08X, bp = %08X, sp = %08X\n\n", ax, ip, bp, sp);
+template <typename policy>
+int run(int argc, const char** argv)
+{
+	// vm register
+	int ax = 0, ip = 0, sp = 0, bp = 0;
+
+	// bound once, instead of looking up the thread's context on every access
+	auto& m = vm.m;
+	auto& natives = compiler.natives;
+#ifdef ICPP_JIT
+	auto& jit_calls = vm.jit_calls;
+#endif
+	auto& profile_ops = vm.profile_ops;
+	auto& profile_pairs = vm.profile_pairs;
+	auto& profile_code = vm.profile_code;
+
+	// load code & data
+	int code_loading_position = load_program();
+	size_t loaded = code_loading_position + code_sec_size() + 1;
+
+	// find start entry
+	int main_offset = find_main();
+	if (main_offset < 0) return -1;
+	ip = code_loading_position + main_offset;
+
+	prepare_stack(argc, argv, ip, loaded - 1, sp, bp);
+	const int stack_base = m.stack_base(); // checked by ENTER, as a frame may be larger than the guard area
+
+	// pre-decode the loaded image into handler addresses, so that each
+	// instruction dispatches with a single indirect jump
+#ifdef ICPP_COMPUTED_GOTO
+	static const void* const handlers[] = {
+		&&op_EXIT,  &&op_PUSH,  &&op_POP,  &&op_ADJ,
+		&&op_MOV,   &&op_LEA,   &&op_GET,  &&op_PUT, &&op_LLEA, &&op_LGET, &&op_LPUT,
+		&&op_SGET,  &&op_SPUT,
+		&&op_ADD,   &&op_SUB,   &&op_MUL,  &&op_DIV, &&op_MOD,  &&op_NEG,  &&op_INC,  &&op_DEC,
+		&&op_SHL,   &&op_SHR,   &&op_AND,  &&op_OR,  &&op_NOT,
+		&&op_EQ,    &&op_NE,    &&op_GE,   &&op_GT,  &&op_LE,   &&op_LT,   &&op_LAND, &&op_LOR,  &&op_LNOT,
+		&&op_ENTER, &&op_LEAVE, &&op_CALL, &&op_RET, &&op_JMP,  &&op_JZ,   &&op_JNZ,
+		&&op_CALLX, &&op_TAILCALL,
+		&&op_LGETPUSH, &&op_PUSHI, &&op_ADDI, &&op_SUBI, &&op_MULI,
+		&&op_EQI,   &&op_NEI,   &&op_GEI,  &&op_GTI, &&op_LEI,  &&op_LTI,
+		&&op_WGET,  &&op_WPUT,  &&op_WLGET, &&op_WLPUT,
+		&&op_LADD,  &&op_LSUB,  &&op_LMUL, &&op_LDIV, &&op_LMOD,
+		&&op_LEQ,   &&op_LNE,   &&op_LGE,  &&op_LGT, &&op_LLE,  &&op_LLT,
+		&&op_DADD,  &&op_DSUB,  &&op_DMUL, &&op_DDIV,
+		&&op_DEQ,   &&op_DNE,   &&op_DGE,  &&op_DGT, &&op_DLE,  &&op_DLT,
+		&&op_I2L,   &&op_I2D,   &&op_L2D,  &&op_D2L, &&op_L2I,  &&op_D2I,
+		&&op_INVALID,
+	};
+	static_assert(sizeof(handlers) / sizeof(handlers[0]) == INVALID + 1, "handler table mismatch");
+	auto& decoded = vm.decoded[0];
+	decoded.resize(loaded);
+	for (size_t i = 0; i < loaded; ++i) {
+		decoded[i] = handlers[(m[i] >= 0 && m[i] < INVALID) ? m[i] : INVALID];
+	}
+#ifdef ICPP_JIT
+	bool jit = policy::jit && opt_jit && jit_init(loaded);
+#define VM_JIT_CALL() \
+	if (jit && jit_calls[ip] < JIT_THRESHOLD && ++jit_calls[ip] == JIT_THRESHOLD) { \
+		jit_compile(ip, code_loading_position, decoded, &&op_JIT); \
+	}
+#else
+#define VM_JIT_CALL()
+#endif
+#define VM_DISPATCH() { ++cycle; VM_TRACE(); VM_PROFILE(); goto *decoded[ip++]; }
+#define VM_CASE(code) op_##code
+#define VM_DEFAULT    op_INVALID
+#define VM_NEXT()     VM_DISPATCH()
+#else
+#define VM_DISPATCH() ++cycle; VM_TRACE(); VM_PROFILE(); switch (m[ip++])
+#define VM_CASE(code) case code
+#define VM_DEFAULT    default
+#define VM_NEXT()     continue
+#define VM_JIT_CALL()
+#endif
+#define VM_TRACE() \
+	if (policy::trace) { \
+		log("%zd:\t", cycle); \
+		print_code(m.data(), ip, code_loading_position); \
+		if (verbose >= 2) { \
+			print_vm_env(ax, ip, sp, bp); \
+		} \
+	}
+#define VM_PROFILE() \
+	if (policy::profile) { \
+		int code = (m[ip] >= 0 && m[ip] < INVALID) ? m[ip] : INVALID; \
+		++profile_ops[code]; \
+		if (prev_code >= 0) ++profile_pairs[prev_code * (INVALID + 1) + code]; \
+		prev_code = code; \
+		++profile_code[ip]; \
 	}
 
-	log<1>("System Information:\n"
-			"  sizeof(int) = %zd\n"
-			"  sizeof(void*) = %zd\n"
-			"\n", sizeof(int), sizeof(void*));
 
 	size_t cycle = 0;
+	int prev_code = -1; // for profiling instruction pairs
+	if (policy::profile) profile_code.assign(loaded, 0);
 	for (;;) {
-		++cycle;
-		if (verbose >= 1) {
-			log("%zd:\t", cycle);
-			print_code(m, ip, code_loading_position);
-			if (verbose >= 2) {
-				print_vm_env(ax, ip, sp, bp);
-			}
+		VM_DISPATCH() {
+		VM_CASE(EXIT): { goto vm_exit;          } // exit the program
+		VM_CASE(PUSH): { m[--sp] = ax;          } VM_NEXT(); // push ax to stack
+		VM_CASE(POP ): { ax = m[sp++];          } VM_NEXT(); // pop ax from stack
+		VM_CASE(ADJ ): { sp += m[ip++];         } VM_NEXT(); // adjust stack pointer
+
+		VM_CASE(MOV ): { ax = m[ip++];          } VM_NEXT(); // move immediate to ax
+		VM_CASE(LEA ): { ax = m[ip++];          } VM_NEXT(); // load address to ax
+		VM_CASE(GET ): { ax = m[m[ip++]];       } VM_NEXT(); // get memory to ax
+		VM_CASE(PUT ): { m[m[ip++]] = ax;       } VM_NEXT(); // put ax to memory
+		VM_CASE(LLEA): { ax = bp + m[ip++];     } VM_NEXT(); // load local address to ax
+		VM_CASE(LGET): { ax = m[bp + m[ip++]];  } VM_NEXT(); // get local to ax
+		VM_CASE(LPUT): { m[bp + m[ip++]] = ax;  } VM_NEXT(); // put ax to local
+
+		VM_CASE(SGET): { ax = m[m[sp++]];       } VM_NEXT(); // get [stack] to ax
+		VM_CASE(SPUT): { m[m[sp++]] = ax;       } VM_NEXT(); // put ax to [stack]
+
+		VM_CASE(ADD ): { ax = m[sp++] + ax;     } VM_NEXT(); // stack (top) + ax, and pop out
+		VM_CASE(SUB ): { ax = m[sp++] - ax;     } VM_NEXT(); // stack (top) - ax, and pop out
+		VM_CASE(MUL ): { ax = m[sp++] * ax;     } VM_NEXT(); // stack (top) * ax, and pop out
+		VM_CASE(DIV ): { ax = m[sp++] / ax;     } VM_NEXT(); // stack (top) / ax, and pop out
+		VM_CASE(MOD ): { ax = m[sp++] % ax;     } VM_NEXT(); // stack (top) % ax, and pop out
+		VM_CASE(NEG ): { ax = -ax;              } VM_NEXT();
+		VM_CASE(INC ): { ++ax;                  } VM_NEXT();
+		VM_CASE(DEC ): { --ax;                  } VM_NEXT();
+
+		VM_CASE(SHL ): { ax = m[sp++] >> ax;    } VM_NEXT(); // stack (top) >> ax, and pop out
+		VM_CASE(SHR ): { ax = m[sp++] << ax;    } VM_NEXT(); // stack (top) << ax, and pop out
+		VM_CASE(AND ): { ax = m[sp++] & ax;     } VM_NEXT(); // stack (top) & ax, and pop out
+		VM_CASE(OR  ): { ax = m[sp++] | ax;     } VM_NEXT(); // stack (top) | ax, and pop out
+		VM_CASE(NOT ): { ax = ~ax;              } VM_NEXT();
+
+		VM_CASE(EQ  ): { ax = m[sp++] == ax;    } VM_NEXT(); // stack (top) == ax, and pop out
+		VM_CASE(NE  ): { ax = m[sp++] != ax;    } VM_NEXT(); // stack (top) != ax, and pop out
+		VM_CASE(GE  ): { ax = m[sp++] >= ax;    } VM_NEXT(); // stack (top) >= ax, and pop out
+		VM_CASE(GT  ): { ax = m[sp++] >  ax;    } VM_NEXT(); // stack (top) >  ax, and pop out
+		VM_CASE(LE  ): { ax = m[sp++] <= ax;    } VM_NEXT(); // stack (top) <= ax, and pop out
+		VM_CASE(LT  ): { ax = m[sp++] <  ax;    } VM_NEXT(); // stack (top) <  ax, and pop out
+		VM_CASE(LAND): { ax = m[sp++] && ax;    } VM_NEXT(); // stack (top) && ax, and pop out
+		VM_CASE(LOR ): { ax = m[sp++] || ax;    } VM_NEXT(); // stack (top) || ax, and pop out
+		VM_CASE(LNOT): { ax = !ax;              } VM_NEXT();
+
+		VM_CASE(ENTER): { // enter stack frame
+			int n = m[ip++];
+			if (sp - 1 - n < stack_base) { err("stack overflow!\n"); return -1; }
+			m[--sp] = bp; bp = sp; sp -= n;
+		} VM_NEXT();
+		VM_CASE(LEAVE): { sp = bp; bp = m[sp++];                  } VM_NEXT(); // leave stack frame
+		VM_CASE(CALL ): { int n = m[ip++]; m[--sp] = ip; ip += n; VM_JIT_CALL(); } VM_NEXT(); // call subroutine
+		VM_CASE(RET  ): { int n = m[ip]; ip = m[sp++]; sp += n;   } VM_NEXT(); // exit subroutine
+		VM_CASE(JMP  ): { int n = m[ip++]; ip += n;               } VM_NEXT(); // goto
+		VM_CASE(JZ   ): { int n = m[ip++]; if (!ax) ip += n;      } VM_NEXT(); // goto if !ax
+		VM_CASE(JNZ  ): { int n = m[ip++]; if (ax) ip += n;       } VM_NEXT(); // goto if ax
+
+		VM_CASE(CALLX): { auto& f = natives[m[ip++]]; ax = call_native(f, sp); sp += f.pop; } VM_NEXT(); // call native function
+		VM_CASE(TAILCALL): { // move arguments over the current ones, and leave the frame (to JMP to callee)
+			int n = m[ip++];
+			for (int i = 0; i < n; ++i) m[bp + 2 + i] = m[sp + i];
+			sp = bp + 1; bp = m[bp];
+		} VM_NEXT();
+
+		VM_CASE(LGETPUSH): { ax = m[bp + m[ip++]]; m[--sp] = ax; } VM_NEXT(); // LGET + PUSH
+		VM_CASE(PUSHI): { ax = m[ip++]; m[--sp] = ax;     } VM_NEXT(); // MOV + PUSH
+		VM_CASE(ADDI ): { ax += m[ip++];                  } VM_NEXT(); // PUSH + MOV + ADD
+		VM_CASE(SUBI ): { ax -= m[ip++];                  } VM_NEXT(); // PUSH + MOV + SUB
+		VM_CASE(MULI ): { ax *= m[ip++];                  } VM_NEXT(); // PUSH + MOV + MUL
+		VM_CASE(EQI  ): { ax = ax == m[ip++];             } VM_NEXT(); // PUSH + MOV + EQ
+		VM_CASE(NEI  ): { ax = ax != m[ip++];             } VM_NEXT(); // PUSH + MOV + NE
+		VM_CASE(GEI  ): { ax = ax >= m[ip++];             } VM_NEXT(); // PUSH + MOV + GE
+		VM_CASE(GTI  ): { ax = ax >  m[ip++];             } VM_NEXT(); // PUSH + MOV + GT
+		VM_CASE(LEI  ): { ax = ax <= m[ip++];             } VM_NEXT(); // PUSH + MOV + LE
+		VM_CASE(LTI  ): { ax = ax <  m[ip++];             } VM_NEXT(); // PUSH + MOV + LT
+
+		VM_CASE(WGET): VM_CASE(WPUT): VM_CASE(WLGET): VM_CASE(WLPUT):
+		VM_CASE(LADD): VM_CASE(LSUB): VM_CASE(LMUL): VM_CASE(LDIV): VM_CASE(LMOD):
+		VM_CASE(LEQ ): VM_CASE(LNE ): VM_CASE(LGE ): VM_CASE(LGT ): VM_CASE(LLE ): VM_CASE(LLT ):
+		VM_CASE(DADD): VM_CASE(DSUB): VM_CASE(DMUL): VM_CASE(DDIV):
+		VM_CASE(DEQ ): VM_CASE(DNE ): VM_CASE(DGE ): VM_CASE(DGT ): VM_CASE(DLE ): VM_CASE(DLT ):
+		VM_CASE(I2L ): VM_CASE(I2D ): VM_CASE(L2D ): VM_CASE(D2L ): VM_CASE(L2I ): VM_CASE(D2I ): { // 'long long' and 'double'
+			int code = m[ip - 1];
+			int param = instruction_has_parameter(code) ? m[ip++] : 0;
+			sp = run_wide(code, param, m.data(), sp, bp, ax);
+		} VM_NEXT();
+
+#ifdef ICPP_JIT
+		op_JIT: { // run compiled code, until it leaves at the returned ip
+			jit_state st = { ax, sp, bp, cycle - 1 };
+			ip = jit_enter(&st, jit_addr[ip - 1]);
+			ax = st.ax; sp = st.sp; bp = st.bp; cycle = st.cycle;
+			if (ip < 0) { err("stack overflow!\n"); return -1; }
+		} VM_NEXT();
+#endif
+		VM_DEFAULT: { warn("unknown instruction: '%d'\n", m[ip - 1]); } VM_NEXT();
 		}
-		size_t i = m[ip++];
-
-		if      (i == EXIT) { break;                } // exit the program
-		else if (i == PUSH) { m[--sp] = ax;         } // push ax to stack
-		else if (i == POP ) { ax = m[sp++];         } // pop ax from stack
-		else if (i == ADJ ) { sp -= m[ip++];        } // adjust stack pointer
-
-		else if (i == MOV ) { ax = m[ip++];         } // move immediate to ax
-		else if (i == LEA ) { ax = m[ip++];         } // load address to ax
-		else if (i == GET ) { ax = m[m[ip++]];      } // get memory to ax
-		else if (i == PUT ) { m[m[ip++]] = ax;      } // put ax to memory
-		else if (i == LLEA) { ax = bp + m[ip++];    } // load local address to ax
-		else if (i == LGET) { ax = m[bp + m[ip++]]; } // get local to ax
-		else if (i == LPUT) { m[bp + m[ip++]] = ax; } // put ax to local
-
-		else if (i == SGET) { ax = m[m[sp++]];      } // get [stack] to ax
-		else if (i == SPUT) { m[m[sp++]] = ax;      } // put ax to [stack]
-
-		else if (i == ADD ) { ax = m[sp++] + ax;    } // stack (top) + ax, and pop out
-		else if (i == SUB ) { ax = m[sp++] - ax;    } // stack (top) - ax, and pop out
-		else if (i == MUL ) { ax = m[sp++] * ax;    } // stack (top) * ax, and pop out
-		else if (i == DIV ) { ax = m[sp++] / ax;    } // stack (top) / ax, and pop out
-		else if (i == MOD ) { ax = m[sp++] % ax;    } // stack (top) % ax, and pop out
-		else if (i == NEG ) { ax = -ax;             }
-		else if (i == INC ) { ++ax;                 }
-		else if (i == DEC ) { --ax;                 }
-
-		else if (i == SHL ) { ax = m[sp++] >> ax;   } // stack (top) >> ax, and pop out
-		else if (i == SHR ) { ax = m[sp++] << ax;   } // stack (top) << ax, and pop out
-		else if (i == AND ) { ax = m[sp++] & ax;    } // stack (top) & ax, and pop out
-		else if (i == OR  ) { ax = m[sp++] | ax;    } // stack (top) | ax, and pop out
-		else if (i == NOT ) { ax = ~ax;             }
-
-		else if (i == EQ  ) { ax = m[sp++] == ax;   } // stack (top) == ax, and pop out
-		else if (i == NE  ) { ax = m[sp++] != ax;   } // stack (top) != ax, and pop out
-		else if (i == GE  ) { ax = m[sp++] >= ax;   } // stack (top) >= ax, and pop out
-		else if (i == GT  ) { ax = m[sp++] >  ax;   } // stack (top) >  ax, and pop out
-		else if (i == LE  ) { ax = m[sp++] <= ax;   } // stack (top) <= ax, and pop out
-		else if (i == LT  ) { ax = m[sp++] <  ax;   } // stack (top) <  ax, and pop out
-		else if (i == LAND) { ax = m[sp++] && ax;   } // stack (top) && ax, and pop out
-		else if (i == LOR ) { ax = m[sp++] || ax;   } // stack (top) || ax, and pop out
-		else if (i == LNOT) { ax = !ax;             }
-
-		else if (i == ENTER) { m[--sp] = bp; bp = sp; sp -= m[ip++];   } // enter stack frame
-		else if (i == LEAVE) { sp = bp; bp = m[sp++];                  } // leave stack frame
-		else if (i == CALL ) { int n = m[ip++]; m[--sp] = ip; ip += n; } // call subroutine
-		else if (i == RET  ) { int n = m[ip]; ip = m[sp++]; sp += n;   } // exit subroutine
-		else if (i == JMP  ) { int n = m[ip++]; ip += n;               } // goto
-		else if (i == JZ   ) { int n = m[ip++]; if (!ax) ip += n;      } // goto if !ax
-		else if (i == JNZ  ) { int n = m[ip++]; if (ax) ip += n;       } // goto if ax
-
-		else { warn("unknown instruction: '%zd'\n", i); }
-
-		if (ip && ip < static_cast<int>(code_loading_position + external_code_size)) {
-			auto it = code_symbol_dict.find(ip - code_loading_position);
-			if (it != code_symbol_dict.end()) {
-				ax = call_ext(it->second, sp);
-			}
+	}
+vm_exit:
+	vm.cycles = cycle;
+#undef VM_JIT_CALL
+#undef VM_DISPATCH
+#undef VM_CASE
+#undef VM_DEFAULT
+#undef VM_NEXT
+#undef VM_TRACE
+#undef VM_PROFILE
+	log<0>(COLOR_YELLOW "Total: %zd cycle(s), return %d\n" COLOR_NORMAL, cycle, ax);
+	if (policy::profile) {
+		if (opt_profile_ops) {
+			print_profile(cycle);
+			if (profile_file) dump_profile(profile_file);
+		}
+		if (opt_profile_lines) print_line_profile(cycle, code_loading_position);
+	}
+	return ax;
+}
+
+template <typename policy>
+int run_tos(int argc, const char** argv)
+{
+	// vm register, and the top two stack slots cached in t0 (top) and t1:
+	// in state s0 nothing is cached, in s1 stack is [ t0, m[sp], ... ],
+	// and in s2 stack is [ t0, t1, m[sp], ... ]
+	int ax = 0, ip = 0, sp = 0, bp = 0;
+	int t0 = 0, t1 = 0;
+
+	// bound once, instead of looking up the thread's context on every access
+	auto& m = vm.m;
+	auto& natives = compiler.natives;
+
+	// load code & data
+	int code_loading_position = load_program();
+	size_t loaded = code_loading_position + code_sec_size() + 1;
+
+	// find start entry
+	int main_offset = find_main();
+	if (main_offset < 0) return -1;
+	ip = code_loading_position + main_offset;
+
+	prepare_stack(argc, argv, ip, loaded - 1, sp, bp);
+	const int stack_base = m.stack_base(); // checked by ENTER, as a frame may be larger than the guard area
+
+	// pre-decode the loaded image once per cache state; every handler knows
+	// its own state, and dispatches through the table of the next state
+	enum { s0 = 0, s1 = 1, s2 = 2 };
+#define TOS_HANDLERS(s) { \
+		&&s##_EXIT,  &&s##_PUSH,  &&s##_POP,  &&s##_ADJ, \
+		&&s##_MOV,   &&s##_LEA,   &&s##_GET,  &&s##_PUT, &&s##_LLEA, &&s##_LGET, &&s##_LPUT, \
+		&&s##_SGET,  &&s##_SPUT, \
+		&&s##_ADD,   &&s##_SUB,   &&s##_MUL,  &&s##_DIV, &&s##_MOD,  &&s##_NEG,  &&s##_INC,  &&s##_DEC, \
+		&&s##_SHL,   &&s##_SHR,   &&s##_AND,  &&s##_OR,  &&s##_NOT, \
+		&&s##_EQ,    &&s##_NE,    &&s##_GE,   &&s##_GT,  &&s##_LE,   &&s##_LT,   &&s##_LAND, &&s##_LOR,  &&s##_LNOT, \
+		&&s##_ENTER, &&s##_LEAVE, &&s##_CALL, &&s##_RET, &&s##_JMP,  &&s##_JZ,   &&s##_JNZ, \
+		&&s##_CALLX, &&s##_TAILCALL, \
+		&&s##_LGETPUSH, &&s##_PUSHI, &&s##_ADDI, &&s##_SUBI, &&s##_MULI, \
+		&&s##_EQI,   &&s##_NEI,   &&s##_GEI,  &&s##_GTI, &&s##_LEI,  &&s##_LTI, \
+		&&s##_WGET,  &&s##_WPUT,  &&s##_WLGET, &&s##_WLPUT, \
+		&&s##_LADD,  &&s##_LSUB,  &&s##_LMUL, &&s##_LDIV, &&s##_LMOD, \
+		&&s##_LEQ,   &&s##_LNE,   &&s##_LGE,  &&s##_LGT, &&s##_LLE,  &&s##_LLT, \
+		&&s##_DADD,  &&s##_DSUB,  &&s##_DMUL, &&s##_DDIV, \
+		&&s##_DEQ,   &&s##_DNE,   &&s##_DGE,  &&s##_DGT, &&s##_DLE,  &&s##_DLT, \
+		&&s##_I2L,   &&s##_I2D,   &&s##_L2D,  &&s##_D2L, &&s##_L2I,  &&s##_D2I, \
+		&&s##_INVALID, \
+	}
+#ifdef ICPP_COMPUTED_GOTO
+	static const void* const handlers[3][INVALID + 1] = { TOS_HANDLERS(s0), TOS_HANDLERS(s1), TOS_HANDLERS(s2) };
+	static_assert(sizeof(handlers[0]) / sizeof(handlers[0][0]) == INVALID + 1, "handler table mismatch");
+	auto& decoded = vm.decoded;
+	for (size_t s = 0; s < 3; ++s) {
+		decoded[s].resize(loaded);
+		for (size_t i = 0; i < loaded; ++i) {
+			decoded[s][i] = handlers[s][(m[i] >= 0 && m[i] < INVALID) ? m[i] : INVALID];
+		}
+	}
+#define VM_DISPATCH()    VM_NEXT(s0)
+#define VM_CASE(s, code) s##_##code
+#define VM_NEXT(s)       { ++cycle; VM_TRACE(s); goto *decoded[s][ip++]; }
+#define VM_FALLTHROUGH
+#else
+	int state = s0;
+#define VM_DISPATCH() \
+	++cycle; VM_TRACE(state); \
+	switch (state * (INVALID + 1) + ((m[ip] >= 0 && m[ip] < INVALID) ? m[ip++] : (++ip, INVALID)))
+#define VM_CASE(s, code) case s * (INVALID + 1) + code
+#define VM_NEXT(s)       { state = s; continue; }
+#define VM_FALLTHROUGH   [[fallthrough]];
+#endif
+#undef TOS_HANDLERS
+#define VM_TRACE(cached) \
+	if (policy::trace) { \
+		log("%zd:\t", cycle); \
+		print_code(m.data(), ip, code_loading_position); \
+		if (verbose >= 2) { \
+			print_vm_env(ax, ip, sp, bp); \
+			log("\t[cached]: %d", (cached)); \
+			if ((cached) >= 1) log(", t0 = 0x%08X", t0); \
+			if ((cached) >= 2) log(", t1 = 0x%08X", t1); \
+			log("\n\n"); \
+		} \
+	}
+// instruction not touching the stack
+#define TOS_KEEP(code, body) \
+		VM_CASE(s0, code): { body; } VM_NEXT(s0); \
+		VM_CASE(s1, code): { body; } VM_NEXT(s1); \
+		VM_CASE(s2, code): { body; } VM_NEXT(s2);
+// instruction pushing ax to stack, after body
+#define TOS_PUSH(code, body) \
+		VM_CASE(s0, code): { body; t0 = ax;                        } VM_NEXT(s1); \
+		VM_CASE(s1, code): { body; t1 = t0; t0 = ax;               } VM_NEXT(s2); \
+		VM_CASE(s2, code): { body; m[--sp] = t1; t1 = t0; t0 = ax; } VM_NEXT(s2);
+// instruction popping stack top to x, before body
+#define TOS_POP(code, body) \
+		VM_CASE(s0, code): { int x = m[sp++];     body; } VM_NEXT(s0); \
+		VM_CASE(s1, code): { int x = t0;          body; } VM_NEXT(s0); \
+		VM_CASE(s2, code): { int x = t0; t0 = t1; body; } VM_NEXT(s1);
+// instruction working on stack in memory, so the cached slots are spilled first
+#define TOS_SPILL(code, body) \
+		VM_CASE(s2, code): m[--sp] = t1; VM_FALLTHROUGH \
+		VM_CASE(s1, code): m[--sp] = t0; VM_FALLTHROUGH \
+		VM_CASE(s0, code): { body; } VM_NEXT(s0);
+// wide instruction, all run by run_wide() on the spilled stack
+#define TOS_WIDE(code) \
+		VM_CASE(s2, code): m[--sp] = t1; VM_FALLTHROUGH \
+		VM_CASE(s1, code): m[--sp] = t0; VM_FALLTHROUGH \
+		VM_CASE(s0, code): goto tos_wide;
+
+	size_t cycle = 0;
+	for (;;) {
+		VM_DISPATCH() {
+		TOS_SPILL(EXIT, { goto vm_exit; }) // exit the program
+		TOS_PUSH (PUSH, {})                       // push ax to stack
+		TOS_POP  (POP,  { ax = x; })              // pop ax from stack
+		TOS_SPILL(ADJ,  { sp += m[ip++]; })       // adjust stack pointer
+
+		TOS_KEEP (MOV,  { ax = m[ip++];         }) // move immediate to ax
+		TOS_KEEP (LEA,  { ax = m[ip++];         }) // load address to ax
+		TOS_KEEP (GET,  { ax = m[m[ip++]];      }) // get memory to ax
+		TOS_KEEP (PUT,  { m[m[ip++]] = ax;      }) // put ax to memory
+		TOS_KEEP (LLEA, { ax = bp + m[ip++];    }) // load local address to ax
+		TOS_KEEP (LGET, { ax = m[bp + m[ip++]]; }) // get local to ax
+		TOS_KEEP (LPUT, { m[bp + m[ip++]] = ax; }) // put ax to local
+
+		TOS_POP  (SGET, { ax = m[x];            }) // get [stack] to ax
+		TOS_POP  (SPUT, { m[x] = ax;            }) // put ax to [stack]
+
+		TOS_POP  (ADD,  { ax = x + ax;          }) // stack (top) + ax, and pop out
+		TOS_POP  (SUB,  { ax = x - ax;          }) // stack (top) - ax, and pop out
+		TOS_POP  (MUL,  { ax = x * ax;          }) // stack (top) * ax, and pop out
+		TOS_POP  (DIV,  { ax = x / ax;          }) // stack (top) / ax, and pop out
+		TOS_POP  (MOD,  { ax = x % ax;          }) // stack (top) % ax, and pop out
+		TOS_KEEP (NEG,  { ax = -ax;             })
+		TOS_KEEP (INC,  { ++ax;                 })
+		TOS_KEEP (DEC,  { --ax;                 })
+
+		TOS_POP  (SHL,  { ax = x >> ax;         }) // stack (top) >> ax, and pop out
+		TOS_POP  (SHR,  { ax = x << ax;         }) // stack (top) << ax, and pop out
+		TOS_POP  (AND,  { ax = x & ax;          }) // stack (top) & ax, and pop out
+		TOS_POP  (OR,   { ax = x | ax;          }) // stack (top) | ax, and pop out
+		TOS_KEEP (NOT,  { ax = ~ax;             })
+
+		TOS_POP  (EQ,   { ax = x == ax;         }) // stack (top) == ax, and pop out
+		TOS_POP  (NE,   { ax = x != ax;         }) // stack (top) != ax, and pop out
+		TOS_POP  (GE,   { ax = x >= ax;         }) // stack (top) >= ax, and pop out
+		TOS_POP  (GT,   { ax = x >  ax;         }) // stack (top) >  ax, and pop out
+		TOS_POP  (LE,   { ax = x <= ax;         }) // stack (top) <= ax, and pop out
+		TOS_POP  (LT,   { ax = x <  ax;         }) // stack (top) <  ax, and pop out
+		TOS_POP  (LAND, { ax = x && ax;         }) // stack (top) && ax, and pop out
+		TOS_POP  (LOR,  { ax = x || ax;         }) // stack (top) || ax, and pop out
+		TOS_KEEP (LNOT, { ax = !ax;             })
+
+		TOS_SPILL(ENTER, { // enter stack frame
+			int n = m[ip++];
+			if (sp - 1 - n < stack_base) { err("stack overflow!\n"); return -1; }
+			m[--sp] = bp; bp = sp; sp -= n;
+		})
+		VM_CASE(s2, LEAVE): VM_CASE(s1, LEAVE):                             // cached slots are dropped with the frame
+		VM_CASE(s0, LEAVE): { sp = bp; bp = m[sp++];              } VM_NEXT(s0); // leave stack frame
+		TOS_SPILL(CALL, { int n = m[ip++]; m[--sp] = ip; ip += n; }) // call subroutine
+		TOS_SPILL(RET,  { int n = m[ip]; ip = m[sp++]; sp += n;   }) // exit subroutine
+		TOS_KEEP (JMP,  { int n = m[ip++]; ip += n;                     }) // goto
+		TOS_KEEP (JZ,   { int n = m[ip++]; if (!ax) ip += n;            }) // goto if !ax
+		TOS_KEEP (JNZ,  { int n = m[ip++]; if (ax) ip += n;             }) // goto if ax
+
+		TOS_SPILL(CALLX, { auto& f = natives[m[ip++]]; ax = call_native(f, sp); sp += f.pop; }) // call native function
+		TOS_SPILL(TAILCALL, { int n = m[ip++]; for (int i = 0; i < n; ++i) m[bp + 2 + i] = m[sp + i]; sp = bp + 1; bp = m[bp]; })
+
+		TOS_PUSH (LGETPUSH, { ax = m[bp + m[ip++]]; }) // LGET + PUSH
+		TOS_PUSH (PUSHI, { ax = m[ip++];        }) // MOV + PUSH
+		TOS_KEEP (ADDI,  { ax += m[ip++];       }) // PUSH + MOV + ADD
+		TOS_KEEP (SUBI,  { ax -= m[ip++];       }) // PUSH + MOV + SUB
+		TOS_KEEP (MULI,  { ax *= m[ip++];       }) // PUSH + MOV + MUL
+		TOS_KEEP (EQI,   { ax = ax == m[ip++];  }) // PUSH + MOV + EQ
+		TOS_KEEP (NEI,   { ax = ax != m[ip++];  }) // PUSH + MOV + NE
+		TOS_KEEP (GEI,   { ax = ax >= m[ip++];  }) // PUSH + MOV + GE
+		TOS_KEEP (GTI,   { ax = ax >  m[ip++];  }) // PUSH + MOV + GT
+		TOS_KEEP (LEI,   { ax = ax <= m[ip++];  }) // PUSH + MOV + LE
+		TOS_KEEP (LTI,   { ax = ax <  m[ip++];  }) // PUSH + MOV + LT
+
+		TOS_WIDE(WGET) TOS_WIDE(WPUT) TOS_WIDE(WLGET) TOS_WIDE(WLPUT)
+		TOS_WIDE(LADD) TOS_WIDE(LSUB) TOS_WIDE(LMUL) TOS_WIDE(LDIV) TOS_WIDE(LMOD)
+		TOS_WIDE(LEQ)  TOS_WIDE(LNE)  TOS_WIDE(LGE)  TOS_WIDE(LGT)  TOS_WIDE(LLE)  TOS_WIDE(LLT)
+		TOS_WIDE(DADD) TOS_WIDE(DSUB) TOS_WIDE(DMUL) TOS_WIDE(DDIV)
+		TOS_WIDE(DEQ)  TOS_WIDE(DNE)  TOS_WIDE(DGE)  TOS_WIDE(DGT)  TOS_WIDE(DLE)  TOS_WIDE(DLT)
+		TOS_WIDE(I2L)  TOS_WIDE(I2D)  TOS_WIDE(L2D)  TOS_WIDE(D2L)  TOS_WIDE(L2I)  TOS_WIDE(D2I)
+		tos_wide: { // 'long long' and 'double'
+			int code = m[ip - 1];
+			int param = instruction_has_parameter(code) ? m[ip++] : 0;
+			sp = run_wide(code, param, m.data(), sp, bp, ax);
+		} VM_NEXT(s0);
+
+		TOS_KEEP (INVALID, { warn("unknown instruction: '%d'\n", m[ip - 1]); })
+		}
+	}
+vm_exit:
+	vm.cycles = cycle;
+#undef VM_DISPATCH
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_FALLTHROUGH
+#undef VM_TRACE
+#undef TOS_KEEP
+#undef TOS_PUSH
+#undef TOS_POP
+#undef TOS_SPILL
+#undef TOS_WIDE
+	log<0>(COLOR_YELLOW "Total: %zd cycle(s), return %d\n" COLOR_NORMAL, cycle, ax);
+	return ax;
+}
+
+template <typename policy>
+int run_reg(int argc, const char** argv)
+{
+	translate_to_reg();
+
+	// vm register
+	int ax = 0, ip = 0, sp = 0, bp = 0;
+
+	// bound once, instead of looking up the thread's context on every access
+	auto& m = vm.m;
+	auto& natives = compiler.natives;
+	auto& reg_code = compiler.reg_code;
+
+	// load data (code is loaded too, but not used)
+	load_program();
+
+	// find start entry
+	int main_offset = find_main();
+	if (main_offset < 0) return -1;
+	ip = reg_code_offset(main_offset);
+
+	prepare_stack(argc, argv, ip, reg_exit_addr, sp, bp);
+	const int stack_base = m.stack_base(); // checked by ENTER, as a frame may be larger than the guard area
+
+#ifdef ICPP_COMPUTED_GOTO
+	static const void* const handlers[] = {
+		&&op_R_EXIT,  &&op_R_MOV,   &&op_R_MOVI,  &&op_R_LEA,  &&op_R_GET,  &&op_R_PUT,  &&op_R_PUTI,  &&op_R_LOAD, &&op_R_STORE, &&op_R_STOREI,
+		&&op_R_GETAX, &&op_R_SETAX, &&op_R_SETAXI,
+		&&op_R_ADD,   &&op_R_SUB,   &&op_R_MUL,   &&op_R_DIV,  &&op_R_MOD,  &&op_R_SHL,  &&op_R_SHR,   &&op_R_AND,  &&op_R_OR,
+		&&op_R_EQ,    &&op_R_NE,    &&op_R_GE,    &&op_R_GT,   &&op_R_LE,   &&op_R_LT,   &&op_R_LAND,  &&op_R_LOR,
+		&&op_R_ADDI,  &&op_R_SUBI,  &&op_R_MULI,  &&op_R_DIVI, &&op_R_MODI, &&op_R_SHLI, &&op_R_SHRI,  &&op_R_ANDI, &&op_R_ORI,
+		&&op_R_EQI,   &&op_R_NEI,   &&op_R_GEI,   &&op_R_GTI,  &&op_R_LEI,  &&op_R_LTI,  &&op_R_LANDI, &&op_R_LORI,
+		&&op_R_NEG,   &&op_R_INC,   &&op_R_DEC,   &&op_R_NOT,  &&op_R_LNOT,
+		&&op_R_ENTER, &&op_R_LEAVE, &&op_R_CALL,  &&op_R_CALLX, &&op_R_TAILCALL, &&op_R_RET, &&op_R_JMP, &&op_R_JZ, &&op_R_JNZ, &&op_R_JZR, &&op_R_JNZR,
+		&&op_R_WIDE,
+		&&op_R_INVALID,
+	};
+	static_assert(sizeof(handlers) / sizeof(handlers[0]) == R_INVALID + 1, "handler table mismatch");
+	auto& decoded = vm.decoded[0];
+	decoded.assign(reg_code.size(), nullptr);
+	for (size_t i = 0; i < reg_code.size(); i += REG_CODE_SIZE) {
+		decoded[i] = handlers[(reg_code[i] >= 0 && reg_code[i] < R_INVALID) ? reg_code[i] : R_INVALID];
+	}
+#define VM_DISPATCH() { ++cycle; VM_TRACE(); c = &reg_code[ip]; ip += REG_CODE_SIZE; goto *decoded[ip - REG_CODE_SIZE]; }
+#define VM_CASE(code) op_##code
+#define VM_DEFAULT    op_R_INVALID
+#define VM_NEXT()     VM_DISPATCH()
+#else
+#define VM_DISPATCH() ++cycle; VM_TRACE(); c = &reg_code[ip]; ip += REG_CODE_SIZE; switch (c[0])
+#define VM_CASE(code) case code
+#define VM_DEFAULT    default
+#define VM_NEXT()     continue
+#endif
+#define VM_TRACE() \
+	if (policy::trace) { \
+		log("%zd:\t", cycle); \
+		print_reg_code(ip); \
+		if (verbose >= 2) { \
+			print_vm_env(ax, ip, sp, bp); \
+		} \
+	}
+#define R(r) m[bp + (r)]
+#define VM_BINARY(code, expr) \
+		VM_CASE(R_##code     ): { int a = R(c[2]), b = R(c[3]); R(c[1]) = (expr); } VM_NEXT(); \
+		VM_CASE(R_##code##I  ): { int a = R(c[2]), b = c[3];    R(c[1]) = (expr); } VM_NEXT();
+
+	const int* c = nullptr;
+	size_t cycle = 0;
+	for (;;) {
+		VM_DISPATCH() {
+		VM_CASE(R_EXIT  ): { goto vm_exit;                     } // exit the program
+		VM_CASE(R_MOV   ): { R(c[1]) = R(c[2]);                } VM_NEXT(); // register to register
+		VM_CASE(R_MOVI  ): { R(c[1]) = c[2];                   } VM_NEXT(); // immediate to register
+		VM_CASE(R_LEA   ): { R(c[1]) = bp + c[2];              } VM_NEXT(); // local address to register
+		VM_CASE(R_GET   ): { R(c[1]) = m[c[2]];                } VM_NEXT(); // memory to register
+		VM_CASE(R_PUT   ): { m[c[1]] = R(c[2]);                } VM_NEXT(); // register to memory
+		VM_CASE(R_PUTI  ): { m[c[1]] = c[2];                   } VM_NEXT(); // immediate to memory
+		VM_CASE(R_LOAD  ): { R(c[1]) = m[R(c[2])];             } VM_NEXT(); // [register] to register
+		VM_CASE(R_STORE ): { m[R(c[1])] = R(c[2]);             } VM_NEXT(); // register to [register]
+		VM_CASE(R_STOREI): { m[R(c[1])] = c[2];                } VM_NEXT(); // immediate to [register]
+		VM_CASE(R_GETAX ): { R(c[1]) = ax;                     } VM_NEXT(); // ax to register
+		VM_CASE(R_SETAX ): { ax = R(c[1]);                     } VM_NEXT(); // register to ax
+		VM_CASE(R_SETAXI): { ax = c[1];                        } VM_NEXT(); // immediate to ax
+
+		VM_BINARY(ADD,  a +  b)
+		VM_BINARY(SUB,  a -  b)
+		VM_BINARY(MUL,  a *  b)
+		VM_BINARY(DIV,  a /  b)
+		VM_BINARY(MOD,  a %  b)
+		VM_BINARY(SHL,  a >> b) // same as SHL in run()
+		VM_BINARY(SHR,  a << b) // same as SHR in run()
+		VM_BINARY(AND,  a &  b)
+		VM_BINARY(OR,   a |  b)
+		VM_BINARY(EQ,   a == b)
+		VM_BINARY(NE,   a != b)
+		VM_BINARY(GE,   a >= b)
+		VM_BINARY(GT,   a >  b)
+		VM_BINARY(LE,   a <= b)
+		VM_BINARY(LT,   a <  b)
+		VM_BINARY(LAND, a && b)
+		VM_BINARY(LOR,  a || b)
+
+		VM_CASE(R_NEG   ): { R(c[1]) = -R(c[2]);               } VM_NEXT();
+		VM_CASE(R_INC   ): { R(c[1]) = R(c[2]) + 1;            } VM_NEXT();
+		VM_CASE(R_DEC   ): { R(c[1]) = R(c[2]) - 1;            } VM_NEXT();
+		VM_CASE(R_NOT   ): { R(c[1]) = ~R(c[2]);               } VM_NEXT();
+		VM_CASE(R_LNOT  ): { R(c[1]) = !R(c[2]);               } VM_NEXT();
+
+		VM_CASE(R_ENTER ): { // enter stack frame
+			if (sp - 1 - c[1] < stack_base) { err("stack overflow!\n"); return -1; }
+			m[--sp] = bp; bp = sp; sp -= c[1];
+		} VM_NEXT();
+		VM_CASE(R_LEAVE ): { sp = bp; bp = m[sp++];                         } VM_NEXT(); // leave stack frame
+		VM_CASE(R_CALL  ): { sp = bp + c[2]; m[--sp] = ip; ip = c[1];       } VM_NEXT(); // call subroutine, with arguments up from [bp + c[2]]
+		VM_CASE(R_CALLX ): { sp = bp + c[2]; ax = call_native(natives[c[1]], sp); } VM_NEXT(); // call native function
+		VM_CASE(R_TAILCALL): { // move c[1] arguments up from [bp + c[2]] over the current ones, and leave the frame
+			for (int i = 0; i < c[1]; ++i) m[bp + 2 + i] = m[bp + c[2] + i];
+			sp = bp + 1; bp = m[bp];
+		} VM_NEXT();
+		VM_CASE(R_RET   ): { ip = m[sp++]; sp += c[1];                      } VM_NEXT(); // exit subroutine
+		VM_CASE(R_JMP   ): { ip = c[1];                                     } VM_NEXT(); // goto
+		VM_CASE(R_JZ    ): { if (!ax) ip = c[1];                            } VM_NEXT(); // goto if !ax
+		VM_CASE(R_JNZ   ): { if (ax) ip = c[1];                             } VM_NEXT(); // goto if ax
+		VM_CASE(R_JZR   ): { ax = R(c[1]); if (!ax) ip = c[2];              } VM_NEXT(); // goto if !register
+		VM_CASE(R_JNZR  ): { ax = R(c[1]); if (ax) ip = c[2];               } VM_NEXT(); // goto if register
+		VM_CASE(R_WIDE  ): { run_wide(c[1], c[2], m.data(), bp + c[3], bp, ax); } VM_NEXT(); // 'long long' and 'double'
+
+		VM_DEFAULT: { warn("unknown instruction: '%d'\n", c[0]); } VM_NEXT();
 		}
 	}
+vm_exit:
+	vm.cycles = cycle;
+#undef VM_DISPATCH
+#undef VM_CASE
+#undef VM_DEFAULT
+#undef VM_NEXT
+#undef VM_TRACE
+#undef R
+#undef VM_BINARY
 	log<0>(COLOR_YELLOW "Total: %zd cycle(s), return %d\n" COLOR_NORMAL, cycle, ax);
 	return ax;
 }
 
+void reset_context() // forget the program compiled and run by this thread
+{
+#ifdef ICPP_JIT
+	jit_release();
+#endif
+	compiler = compiler_context();
+	if (vm.image_fd >= 0) close(vm.image_fd);
+	vm_memory mem = move(vm.m); // reused, only handing its pages back
+	vm = vm_context();
+	mem.clear();
+	vm.m = move(mem);
+}
+
+template <typename policy>
+int execute(int argc, const char** argv)
+{
+	sigjmp_buf fault;
+	if (sigsetjmp(fault, 1)) { // guest code faulted, and the engine's frame is gone
+		vm_fault_jump = nullptr;
+		if (vm_fault_error) { // from a native called by compiled code
+			exception_ptr e = vm_fault_error;
+			vm_fault_error = nullptr;
+			rethrow_exception(e);
+		}
+		err("%s!\n", vm_fault_reason);
+		return -1;
+	}
+	vm_fault_jump = &fault;
+	int ret = 0;
+	try {
+		ret = opt_reg ? run_reg<policy>(argc, argv) : opt_tos ? run_tos<policy>(argc, argv) : run<policy>(argc, argv);
+	} catch (...) { // err() in batch mode
+		vm_fault_jump = nullptr;
+		throw;
+	}
+	vm_fault_jump = nullptr;
+	return ret;
+}
+
+//--------------------------------------------------------//
+// vm snapshot
+//
+// a snapshot holds the loaded memory image up to its high-water mark, the vm
+// registers, and what the compiler knew about the program (symbols, comments,
+// and optionally source lines), so that it runs again without being lexed and
+// parsed. native handlers are not saved, but bound again by name through
+// init_symbol(). the same format is used for compiled scripts in the cache
+// (.icb files), where loading one maps its image into vm memory unless '-fno-cache'.
+// a checksum of everything after it is kept in the header, so that a damaged file
+// is not run.
+
+const char SNAPSHOT_MAGIC[8] = { 'I', 'C', 'P', 'P', 'S', 'N', 'A', 'P' };
+const int SNAPSHOT_VERSION = 6;
+const size_t SNAPSHOT_CHECKSUM_POS = sizeof(SNAPSHOT_MAGIC) + sizeof(SNAPSHOT_VERSION);
+const size_t SNAPSHOT_IMAGE_ALIGN = 4096;
+
+template <typename T> void snapshot_put(ostream& out, const T& v);
+void snapshot_put(ostream& out, const string& v);
+template <typename T> void snapshot_put(ostream& out, const vector<T>& v);
+template <typename A, typename B> void snapshot_put(ostream& out, const pair<A, B>& v);
+template <typename... T> void snapshot_put(ostream& out, const tuple<T...>& v);
+template <typename T> void snapshot_put(ostream& out, const unordered_set<T>& v);
+template <typename K, typename V> void snapshot_put(ostream& out, const unordered_map<K, V>& v);
+void snapshot_put(ostream& out, const symbol_info& v);
+void snapshot_put(ostream& out, const symbol_entry& v);
+
+template <typename T> void snapshot_get(istream& in, T& v);
+void snapshot_get(istream& in, string& v);
+template <typename T> void snapshot_get(istream& in, vector<T>& v);
+template <typename A, typename B> void snapshot_get(istream& in, pair<A, B>& v);
+template <typename... T> void snapshot_get(istream& in, tuple<T...>& v);
+template <typename T> void snapshot_get(istream& in, unordered_set<T>& v);
+template <typename K, typename V> void snapshot_get(istream& in, unordered_map<K, V>& v);
+void snapshot_get(istream& in, symbol_info& v);
+void snapshot_get(istream& in, symbol_entry& v);
+
+template <typename T> void snapshot_put(ostream& out, const T& v)
+{
+	static_assert(is_arithmetic<T>::value, "unsupported type in snapshot");
+	out.write(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+void snapshot_put(ostream& out, const string& v) { snapshot_put(out, v.size()); out.write(v.data(), v.size()); }
+template <typename T> void snapshot_put(ostream& out, const vector<T>& v) { snapshot_put(out, v.size()); for (const auto& e : v) snapshot_put(out, e); }
+template <typename A, typename B> void snapshot_put(ostream& out, const pair<A, B>& v) { snapshot_put(out, v.first); snapshot_put(out, v.second); }
+template <typename... T> void snapshot_put(ostream& out, const tuple<T...>& v) { apply([&](const auto&... e) { (snapshot_put(out, e), ...); }, v); }
+template <typename T> void snapshot_put(ostream& out, const unordered_set<T>& v) { snapshot_put(out, v.size()); for (const auto& e : v) snapshot_put(out, e); }
+template <typename K, typename V> void snapshot_put(ostream& out, const unordered_map<K, V>& v) { snapshot_put(out, v.size()); for (const auto& e : v) snapshot_put(out, e); }
+void snapshot_put(ostream& out, const symbol_info& v) { snapshot_put(out, tie(v.is_code, v.offset, v.size, v.type->name, v.ret_type->name, v.arg_count, v.depth)); }
+void snapshot_put(ostream& out, const symbol_entry& v) { snapshot_put(out, tie(v.name, v.bindings, v.overloads)); }
+
+// every length read is checked against what is left of the file, so that a broken one
+// fails the stream instead of asking for a huge allocation
+static thread_local size_t snapshot_left = 0; // bytes of the file being loaded, not read yet
+
+bool snapshot_fits(istream& in, size_t n, size_t size) // n items of size bytes each are left, or fail the stream
+{
+	if (in && n <= snapshot_left / size) return true;
+	in.setstate(ios::failbit);
+	return false;
+}
+
+template <typename T> void snapshot_get(istream& in, T& v)
+{
+	static_assert(is_arithmetic<T>::value, "unsupported type in snapshot");
+	if (snapshot_fits(in, 1, sizeof(v))) { in.read(reinterpret_cast<char*>(&v), sizeof(v)); snapshot_left -= sizeof(v); }
+}
+void snapshot_get(istream& in, string& v) { size_t n = 0; snapshot_get(in, n); if (snapshot_fits(in, n, 1)) { v.resize(n); in.read(&v[0], n); snapshot_left -= n; } }
+template <typename T> void snapshot_get(istream& in, vector<T>& v) { size_t n = 0; snapshot_get(in, n); v.clear(); if (!snapshot_fits(in, n, 1)) return; for (T e; in && n-- > 0; v.push_back(e)) snapshot_get(in, e); }
+template <typename A, typename B> void snapshot_get(istream& in, pair<A, B>& v) { snapshot_get(in, v.first); snapshot_get(in, v.second); }
+template <typename... T> void snapshot_get(istream& in, tuple<T...>& v) { apply([&](auto&... e) { (snapshot_get(in, e), ...); }, v); }
+template <typename T> void snapshot_get(istream& in, unordered_set<T>& v) { size_t n = 0; snapshot_get(in, n); v.clear(); if (!snapshot_fits(in, n, 1)) return; for (T e; in && n-- > 0; v.insert(e)) snapshot_get(in, e); }
+template <typename K, typename V> void snapshot_get(istream& in, unordered_map<K, V>& v)
+{
+	size_t n = 0;
+	snapshot_get(in, n);
+	v.clear();
+	if (!snapshot_fits(in, n, 1)) return;
+	for (pair<K, V> e; in && n-- > 0; v.insert(e)) snapshot_get(in, e);
+}
+void snapshot_get(istream& in, symbol_info& v) // types by name, interned again
+{
+	string type, ret_type;
+	auto t = tie(v.is_code, v.offset, v.size, type, ret_type, v.arg_count, v.depth);
+	snapshot_get(in, t);
+	v.type = type_of(type);
+	v.ret_type = type_of(ret_type);
+}
+void snapshot_get(istream& in, symbol_entry& v) { auto t = tie(v.name, v.bindings, v.overloads); snapshot_get(in, t); }
+
+struct fnv1a { // FNV-1a hash
+	uint64_t h = 14695981039346656037ULL;
+	void add(const void* data, size_t size) {
+		for (size_t i = 0; i < size; ++i) h = (h ^ static_cast<const unsigned char*>(data)[i]) * 1099511628211ULL;
+	}
+};
+
+uint64_t snapshot_checksum(istream& in) // of the rest of the file, from the position of in
+{
+	fnv1a sum;
+	char buf[65536];
+	while (in.read(buf, sizeof(buf)) || in.gcount() > 0) sum.add(buf, in.gcount());
+	return sum.h;
+}
+
+size_t snapshot_image_offset(size_t pos) { return (pos + SNAPSHOT_IMAGE_ALIGN - 1) / SNAPSHOT_IMAGE_ALIGN * SNAPSHOT_IMAGE_ALIGN; }
+
+bool save_snapshot(string filename, int ax, int ip, int sp, int bp, bool with_source, bool quiet = false)
+{
+	if (!read_image()) return false;
+	string tmp = filename + ".tmp" + to_string(getpid()) + "." + to_string(hash<thread::id>()(this_thread::get_id()));
+	ofstream out(tmp, ios::binary);
+	if (!out.is_open()) {
+		if (!quiet) err("failed to open file '%s'!\n", tmp.c_str());
+		return false;
+	}
+	out.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	snapshot_put(out, SNAPSHOT_VERSION);
+	snapshot_put(out, uint64_t(0)); // checksum, filled in when all is written
+	snapshot_put(out, static_cast<int>(INVALID));
+	snapshot_put(out, data_sec.size());
+	snapshot_put(out, code_sec.size());
+	snapshot_put(out, make_tuple(ax, ip, sp, bp));
+
+	vector<string> native_names;
+	for (const auto& f : natives) native_names.push_back(f.name);
+	snapshot_put(out, native_names);
+	snapshot_put(out, symbols);
+	snapshot_put(out, data_symbol_dict);
+	snapshot_put(out, code_symbol_dict);
+	snapshot_put(out, signature_ids);
+	snapshot_put(out, overload_index);
+	snapshot_put(out, comments);
+	snapshot_put(out, offset);
+	snapshot_put(out, with_source ? string(src.begin(), src.end()) : string());
+
+	// the image goes last, page aligned, so that it can be mapped straight into vm memory
+	size_t image_offset = snapshot_image_offset(out.tellp());
+	out.seekp(image_offset);
+	int exit_code = EXIT; // main() returns here
+	out.write(reinterpret_cast<const char*>(data_sec.data()), data_sec.size() * sizeof(int));
+	out.write(reinterpret_cast<const char*>(code_sec.data()), code_sec.size() * sizeof(int));
+	out.write(reinterpret_cast<const char*>(&exit_code), sizeof(int));
+	out.close();
+	if (out.good()) {
+		fstream file(tmp, ios::binary | ios::in | ios::out);
+		file.seekg(SNAPSHOT_CHECKSUM_POS + sizeof(uint64_t));
+		uint64_t checksum = snapshot_checksum(file);
+		file.clear();
+		file.seekp(SNAPSHOT_CHECKSUM_POS);
+		snapshot_put(file, checksum);
+		file.close();
+		if (!file.good()) out.setstate(ios::failbit);
+	}
+	if (!out.good() || rename(tmp.c_str(), filename.c_str()) != 0) {
+		remove(tmp.c_str());
+		if (!quiet) err("failed to write snapshot '%s'!\n", filename.c_str());
+		return false;
+	}
+	return true;
+}
+
+int snapshot_at_main(string filename) // save the parsed program, as it is loaded right before main() is called
+{
+	int main_offset = find_main();
+	if (main_offset < 0) return 1;
+	if (!save_snapshot(filename, 0, data_sec_size() + main_offset, 0, 0, true)) return 1;
+	log(COLOR_YELLOW "Snapshot: %zd word(s) of memory written to '%s'\n" COLOR_NORMAL,
+			data_sec_size() + code_sec_size() + 1, filename.c_str());
+	return 0;
+}
+
+bool load_snapshot(string filename, bool quiet = false) // restore what parse() would have produced, with natives bound again
+{
+	ifstream in(filename, ios::binary);
+	if (!in.is_open()) {
+		if (!quiet) err("failed to open file '%s'!\n", filename.c_str());
+		return false;
+	}
+	in.seekg(0, ios::end);
+	size_t file_size = static_cast<size_t>(max<streamoff>(in.tellg(), 0));
+	in.seekg(0);
+	snapshot_left = file_size;
+	char magic[sizeof(SNAPSHOT_MAGIC)] = {};
+	int version = 0, instruction_count = 0;
+	uint64_t checksum = 0;
+	if (snapshot_fits(in, 1, sizeof(magic))) { in.read(magic, sizeof(magic)); snapshot_left -= sizeof(magic); }
+	snapshot_get(in, version);
+	snapshot_get(in, checksum);
+	if (memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0 || version != SNAPSHOT_VERSION) {
+		if (!quiet) err("'%s' is not a snapshot of this version of icpp!\n", filename.c_str());
+		return false;
+	}
+	if (!in || snapshot_checksum(in) != checksum) {
+		if (!quiet) err("snapshot '%s' is damaged!\n", filename.c_str());
+		return false;
+	}
+	in.clear();
+	in.seekg(SNAPSHOT_CHECKSUM_POS + sizeof(uint64_t));
+	snapshot_get(in, instruction_count);
+	if (instruction_count != INVALID) {
+		if (!quiet) err("'%s' is not a snapshot of this version of icpp!\n", filename.c_str());
+		return false;
+	}
+	size_t data_size = 0, code_size = 0;
+	tuple<int, int, int, int> regs; // ax, ip, sp, bp
+	snapshot_get(in, data_size);
+	snapshot_get(in, code_size);
+	snapshot_get(in, regs);
+	if (get<2>(regs) != 0) {
+		if (!quiet) err("snapshot '%s' was taken while running, which can not be resumed yet!\n", filename.c_str());
+		return false;
+	}
+
+	init_symbol();
+	vector<string> native_names;
+	snapshot_get(in, native_names);
+	for (size_t i = 0; i < native_names.size(); ++i) {
+		if (i >= natives.size() || natives[i].name != native_names[i]) {
+			if (!quiet) err("native function '%s' in snapshot '%s' is not available!\n", native_names[i].c_str(), filename.c_str());
+			return false;
+		}
+	}
+	string saved_src;
+	snapshot_get(in, symbols);
+	snapshot_get(in, data_symbol_dict);
+	snapshot_get(in, code_symbol_dict);
+	snapshot_get(in, signature_ids);
+	snapshot_get(in, overload_index);
+	snapshot_get(in, comments);
+	snapshot_get(in, offset);
+	snapshot_get(in, saved_src);
+	size_t image_offset = in ? snapshot_image_offset(in.tellg()) : file_size;
+	if (!in || image_offset > file_size || data_size > (file_size - image_offset) / sizeof(int)
+			|| code_size >= (file_size - image_offset) / sizeof(int) - data_size) { // the exit word follows code
+		if (!quiet) err("invalid snapshot '%s'!\n", filename.c_str());
+		return false;
+	}
+	if (!saved_src.empty()) src.assign(move(saved_src));
+	symbol_ids.clear();
+	for (size_t id = 0; id < symbols.size(); ++id) symbol_ids.insert(make_pair(symbols[id].name, static_cast<int>(id)));
+
+	if (image_offset % sysconf(_SC_PAGESIZE) == 0) {
+		vm.image_fd = open(filename.c_str(), O_RDONLY);
+		vm.image_offset = image_offset;
+	}
+	if (vm.image_fd >= 0) { // mapped by load_program(), and read only if needed
+		vm.image_unread = true;
+		vm.image_data_size = data_size;
+		vm.image_code_size = code_size;
+		return true;
+	}
+	in.seekg(image_offset);
+	data_sec.resize(data_size);
+	code_sec.resize(code_size);
+	in.read(reinterpret_cast<char*>(data_sec.data()), data_size * sizeof(int));
+	in.read(reinterpret_cast<char*>(code_sec.data()), code_size * sizeof(int));
+	if (!in) {
+		if (!quiet) err("snapshot '%s' is truncated!\n", filename.c_str());
+		return false;
+	}
+	return true;
+}
+
+string cache_dir() // $ICPP_CACHE_DIR, or $XDG_CACHE_HOME/icpp, or ~/.cache/icpp
+{
+	if (const char* dir = getenv("ICPP_CACHE_DIR")) return dir;
+	if (const char* dir = getenv("XDG_CACHE_HOME")) return string(dir) + "/icpp";
+	if (const char* dir = getenv("HOME")) return string(dir) + "/.cache/icpp";
+	return "";
+}
+
+#include <link.h>
+
+string build_id() // of icpp itself, from its GNU build-id note, or else its whole binary
+{
+	string id;
+	dl_iterate_phdr([](dl_phdr_info* info, size_t, void* data) { // the first object is icpp
+		for (int i = 0; i < info->dlpi_phnum; ++i) {
+			const ElfW(Phdr)& ph = info->dlpi_phdr[i];
+			if (ph.p_type != PT_NOTE) continue;
+			size_t align = (ph.p_align == 8) ? 8 : 4;
+			const char* p = reinterpret_cast<const char*>(info->dlpi_addr + ph.p_vaddr);
+			const char* end = p + ph.p_memsz;
+			while (p + sizeof(ElfW(Nhdr)) <= end) {
+				const ElfW(Nhdr)* note = reinterpret_cast<const ElfW(Nhdr)*>(p);
+				const char* name = p + sizeof(ElfW(Nhdr));
+				const char* desc = name + (note->n_namesz + align - 1) / align * align;
+				if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 && memcmp(name, "GNU", 4) == 0) {
+					static_cast<string*>(data)->assign(desc, note->n_descsz);
+					break;
+				}
+				p = desc + (note->n_descsz + align - 1) / align * align;
+			}
+		}
+		return 1;
+	}, &id);
+	if (id.empty()) { // linked without '--build-id'
+		ifstream file("/proc/self/exe", ios::binary);
+		id.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+	}
+	return id;
+}
+
+string cache_file(const string& dir) // named by a hash of the source, and everything else the code depends on
+{
+	fnv1a h;
+	static const string build = build_id();
+	int key[] = { SNAPSHOT_VERSION, INVALID, opt_fuse, opt_peephole, opt_level, opt_inline };
+	h.add(build.data(), build.size());
+	h.add(key, sizeof(key));
+	h.add(src.begin(), src.bytes);
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.icb", static_cast<unsigned long long>(h.h));
+	return dir + name;
+}
+
+void compile(const string& filename) // load & parse the source, or reuse its compiled image in the cache
+{
+	if (!load(filename)) return;
+	string dir = opt_cache ? cache_dir() : "";
+	string file = dir.empty() ? "" : cache_file(dir);
+	if (!file.empty() && access(file.c_str(), R_OK) == 0) {
+		source_text source = src;
+		if (load_snapshot(file, true)) {
+			log<1>("Loaded '%s' from cache '%s'\n\n", filename.c_str(), file.c_str());
+			return;
+		}
+		compiler = compiler_context(); // a broken cache file, so compile it again
+		src = source;
+	}
+	parse();
+	if (opt_peephole && opt_level >= 1) peephole();
+	if (opt_inline && opt_level >= 1) inline_calls();
+	if (opt_level >= 2) optimize();
+	if (opt_fuse) fuse();
+	if (!file.empty()) {
+		size_t pos = 0;
+		do {
+			pos = dir.find('/', pos + 1);
+			if (mkdir(dir.substr(0, pos).c_str(), 0755) != 0 && errno != EEXIST) {
+				warn("can not create cache directory '%s': %s\n", dir.substr(0, pos).c_str(), strerror(errno));
+				return;
+			}
+		} while (pos != string::npos);
+		if (!save_snapshot(file, 0, 0, 0, 0, false, true)) warn("can not write cache file '%s'\n", file.c_str());
+	}
+}
+
+//--------------------------------------------------------//
+// batch mode
+
+struct batch_error {}; // thrown by err() in batch workers, instead of exiting the process
+
+struct batch_job {
+	vector<string> args; // script, then its argv
+	int ret = 0;
+	size_t cycles = 0;
+	double wall_ms = 0;
+	bool failed = false;
+};
+
+vector<string> split_args(const string& line) // split by spaces, and "..." keeps spaces in one argument
+{
+	vector<string> args;
+	for (size_t i = 0; i < line.size(); ) {
+		if (isspace(line[i])) { ++i; continue; }
+		string arg;
+		bool quoted = false;
+		for (; i < line.size() && (quoted || !isspace(line[i])); ++i) {
+			if (line[i] == '"') quoted = !quoted; else arg += line[i];
+		}
+		args.push_back(arg);
+	}
+	return args;
+}
+
+bool load_manifest(const char* filename, vector<batch_job>& jobs) // one script with its arguments per line, '#' for comments
+{
+	ifstream file(filename);
+	if (!file.is_open()) {
+		err("failed to open file '%s'!\n", filename);
+		return false;
+	}
+	string line;
+	while (getline(file, line)) {
+		size_t pos = line.find_first_not_of(" \t\r");
+		if (pos == string::npos || line[pos] == '#') continue;
+		batch_job job;
+		job.args = split_args(line);
+		jobs.push_back(job);
+	}
+	return true;
+}
+
+void run_batch_job(batch_job& job, const string& out_dir, size_t id)
+{
+	auto start = chrono::steady_clock::now();
+	string path = out_dir + "/" + to_string(id);
+	ofstream out(path + ".out"), err_out(path + ".err");
+	FILE* log_out = fopen((path + ".log").c_str(), "w");
+
+	reset_context();
+	vm.cout_stream = &out;
+	vm.cerr_stream = &err_out;
+	log_file = log_out;
+	try {
+		compile(job.args[0]);
+		vector<const char*> argv;
+		for (size_t i = 1; i < job.args.size(); ++i) argv.push_back(job.args[i].c_str());
+		argv.push_back(nullptr);
+		int argc = static_cast<int>(job.args.size() - 1);
+		job.ret = (verbose >= 1) ? execute<trace_policy>(argc, argv.data()) : execute<fast_policy>(argc, argv.data());
+		job.cycles = vm.cycles;
+	} catch (const batch_error&) {
+		job.failed = true;
+	}
+	log_file = stderr;
+	if (log_out) fclose(log_out);
+	job.wall_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+int run_batch(const char* manifest, int threads, string out_dir)
+{
+	vector<batch_job> jobs;
+	if (!load_manifest(manifest, jobs)) return 1;
+	if (out_dir.empty()) out_dir = string(manifest) + ".out";
+	if (mkdir(out_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+		err("failed to create directory '%s'!\n", out_dir.c_str());
+		return 1;
+	}
+	if (threads <= 0) threads = max(1u, thread::hardware_concurrency());
+
+	auto start = chrono::steady_clock::now();
+	atomic<size_t> next(0);
+	vector<thread> pool;
+	for (int i = 0; i < threads; ++i) {
+		pool.emplace_back([&] {
+			on_err = [] { if (line_no > 0 && line_no <= src.size()) print_current(); throw batch_error(); };
+			for (size_t id; (id = next++) < jobs.size(); ) {
+				run_batch_job(jobs[id], out_dir, id);
+			}
+			reset_context();
+		});
+	}
+	for (auto& t : pool) t.join();
+	double wall_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+	int failed = 0;
+	printf("id\texit\tcycles\twall_ms\tcommand\n");
+	for (size_t id = 0; id < jobs.size(); ++id) {
+		const batch_job& job = jobs[id];
+		printf("%zd\t%s\t%zd\t%.3f\t", id, job.failed ? "error" : to_string(job.ret).c_str(), job.cycles, job.wall_ms);
+		for (size_t i = 0; i < job.args.size(); ++i) {
+			const string& a = job.args[i];
+			printf((a.find(' ') != string::npos) ? "%s\"%s\"" : "%s%s", i ? " " : "", a.c_str());
+		}
+		printf("\n");
+		if (job.failed) ++failed;
+	}
+	log(COLOR_YELLOW "Batch: %zd job(s), %d failed, %d thread(s), %.1f ms, %.0f job(s)/s\n" COLOR_NORMAL,
+			jobs.size(), failed, threads, wall_ms, jobs.size() * 1000.0 / max(wall_ms, 1e-3));
+	return failed ? 1 : 0;
+}
+
+size_t parse_size(const char* s) // bytes, with an optional K/M/G suffix, or 0 if invalid
+{
+	if (!isdigit(static_cast<unsigned char>(*s))) return 0;
+	char* end = nullptr;
+	errno = 0;
+	unsigned long long n = strtoull(s, &end, 10);
+	if (errno == ERANGE) return 0;
+	int shift = 0;
+	switch (toupper(*end)) {
+	case 'G': shift = 30; ++end; break;
+	case 'M': shift = 20; ++end; break;
+	case 'K': shift = 10; ++end; break;
+	}
+	if (*end || n > (SIZE_MAX >> shift)) return 0;
+	return static_cast<size_t>(n) << shift;
+}
+
 int main(int argc, const char** argv)
 {
 	bool assembly = false;
+	bool lex = false;
 	const char* filename = nullptr;
+	const char* batch = nullptr;
+	int batch_threads = 0;
+	const char* snapshot_at = nullptr;
+	const char* restore = nullptr;
+	string out_path; // batch output directory, or snapshot file
 	for (--argc, ++argv; argc > 0 && !filename; --argc, ++argv) {
 		if (**argv == '-') {
+			if (strcmp(*argv, "--batch") == 0 && argc > 1) { batch = *++argv; --argc; continue; }
+			if (strcmp(*argv, "-j") == 0 && argc > 1) { batch_threads = atoi(*++argv); --argc; continue; }
+			if (strcmp(*argv, "-o") == 0 && argc > 1) { out_path = *++argv; --argc; continue; }
+			if (strcmp(*argv, "--snapshot-at") == 0 && argc > 1) { snapshot_at = *++argv; --argc; continue; }
+			if (strcmp(*argv, "--restore") == 0 && argc > 1) { filename = restore = *++argv; --argc; continue; }
+			if (strcmp(*argv, "-fno-fuse") == 0) { opt_fuse = false; continue; }
+			if (strcmp(*argv, "-fno-peephole") == 0) { opt_peephole = false; continue; }
+			if ((*argv)[1] == 'O' && (*argv)[2] >= '0' && (*argv)[2] <= '2' && !(*argv)[3]) { opt_level = (*argv)[2] - '0'; continue; }
+			if (strcmp(*argv, "-fno-inline") == 0) { opt_inline = false; continue; }
+			if (strcmp(*argv, "-fno-jit") == 0) { opt_jit = false; continue; }
+			if (strcmp(*argv, "-fno-cache") == 0) { opt_cache = false; continue; }
+			if (strncmp(*argv, "--profile-ops", 13) == 0 && (!(*argv)[13] || (*argv)[13] == '=')) {
+				opt_profile_ops = true;
+				if ((*argv)[13] == '=') profile_file = *argv + 14;
+				continue;
+			}
+			if (strcmp(*argv, "--line-profile") == 0) { opt_profile_lines = true; continue; }
+			if (strcmp(*argv, "--lex-only") == 0) { lex = true; continue; }
+			if (strncmp(*argv, "--mem=", 6) == 0 || strncmp(*argv, "--stack=", 8) == 0) {
+				bool mem = ((*argv)[2] == 'm');
+				size_t n = parse_size(strchr(*argv, '=') + 1);
+				if (n == 0) {
+					err("invalid size in '%s'! it should be a positive number of bytes, with an optional K, M or G suffix.\n", *argv);
+					return 1;
+				}
+				(mem ? opt_mem_size : opt_stack_size) = n;
+				continue;
+			}
 			if (*(*argv+1) == 'v') { ++verbose; }
 			if (*(*argv+1) == 's') { assembly = true; }
+			if (*(*argv+1) == 'r') { opt_reg = true; }
+			if (*(*argv+1) == 't') { opt_tos = true; }
 		} else {
 			filename = *argv;
 		}
 	}
+	install_fault_handler();
+	if (batch) {
+		return run_batch(batch, batch_threads, out_path);
+	}
 	if (!filename) {
-		log("usage: icpp [-s] [-v] <foo.cpp> ...\n");
+		log("usage: icpp [-s] [-v] [-r] [-t] [-fno-fuse] [-fno-peephole] [-fno-jit] [-fno-cache] [--profile-ops[=file.csv]] [--line-profile]\n"
+			"            [--mem=64M] [--stack=16M] <foo.cpp> ...\n"
+			"       icpp [-fno-fuse] --snapshot-at main [-o foo.cpp.snap] <foo.cpp>\n"
+			"       icpp [-s] [-v] [-r] [-t] [-fno-jit] [--mem=64M] [--stack=16M] --restore <foo.cpp.snap> ...\n"
+			"       icpp [-r] [-t] [-fno-fuse] [--mem=64M] [--stack=16M] --batch <manifest.txt> [-j N] [-o dir]\n"
+			"       icpp --lex-only <foo.cpp>\n");
 		return false;
 	}
+	if (lex) {
+		return lex_only(filename);
+	}
 	on_err = print_current_and_exit;
-	if (load(filename)) parse();
-	return assembly ? show() : run(argc, argv);
+	if (restore) {
+		load_snapshot(restore);
+	} else {
+		compile(filename);
+	}
+	if (snapshot_at) {
+		if (strcmp(snapshot_at, "main") != 0) {
+			err("only '--snapshot-at main' is supported!\n");
+		}
+		return snapshot_at_main(out_path.empty() ? string(filename) + ".snap" : out_path);
+	}
+	if (assembly) {
+		return opt_reg ? show_reg() : show();
+	}
+	if (opt_profile_ops || opt_profile_lines) {
+		if (opt_reg || opt_tos) {
+			warn("profiling works on the default stack-based VM only\n");
+		} else {
+			return execute<profile_policy>(argc, argv);
+		}
+	}
+	return (verbose >= 1) ? execute<trace_policy>(argc, argv) : execute<fast_policy>(argc, argv);
 }
@@ -0,0 +1,29 @@
+#include <iostream>
+using namespace std;
+
+int sum(int n, int acc)
+{
+	if (n == 0) return acc;
+	return sum(n - 1, acc + n);
+}
+
+int count(int n, int acc)
+{
+	if (n == 0) return acc;
+	return count(n - 1, acc + 1);
+}
+
+int gcd(int a, int b)
+{
+	if (b == 0) return a;
+	return gcd(b, a % b);
+}
+
+int main()
+{
+	cout << "sum(10) = " << sum(10, 0) << endl;
+	cout << "sum(60000) = " << sum(60000, 0) << endl;
+	cout << "count(100000) = " << count(100000, 0) << endl;
+	cout << "gcd(1071, 462) = " << gcd(1071, 462) << endl;
+	return 0;
+}
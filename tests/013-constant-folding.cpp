@@ -0,0 +1,14 @@
+#include <cstdio>
+
+int main()
+{
+	int x = 1 + 2 * 3;
+	int y = (x + 2) * 3 + sizeof(x) * 512;
+	int a[4] = { 10, 20, 30, 40 };
+	printf("x = %d, y = %d\n", x, y);
+	printf("a[1] = %d, a[3] = %d\n", a[1], a[3]);
+	printf("sizeof(x) * 8 = %d\n", sizeof(x) * 8);
+	printf("100 / 7 = %d, 100 %% 7 = %d\n", 100 / 7, 100 % 7);
+	printf("(1 < 2) && (3 > 2) = %d\n", (1 < 2) && (3 > 2));
+	return 0;
+}
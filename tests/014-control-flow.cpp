@@ -0,0 +1,42 @@
+#include <cstdio>
+
+int sign(int x)
+{
+	if (x > 0) {
+		return 1;
+	} else if (x < 0) {
+		return 0 - 1;
+	}
+	return 0;
+}
+
+int first_multiple(int n, int k)
+{
+	for (int i = 1; i <= n; ++i) {
+		if (i % k == 0) return i;
+	}
+	return 0;
+}
+
+int main()
+{
+	int total = 0;
+	for (int i = 0; i < 5; ++i) {
+		for (int j = 0; j < i; ++j) {
+			total = total + j;
+		}
+	}
+	int n = 10;
+	while (n > 0) {
+		if (n % 3 == 0) {
+			total = total + n;
+		} else {
+			total = total - 1;
+		}
+		n = n - 1;
+	}
+	printf("total = %d\n", total);
+	printf("sign: %d %d %d\n", sign(5), sign(0 - 5), sign(0));
+	printf("first_multiple: %d %d\n", first_multiple(20, 7), first_multiple(5, 9));
+	return 0;
+}
@@ -0,0 +1,54 @@
+#include <cstdio>
+
+int g;
+
+int bump()
+{
+	g = g + 1;
+	return g;
+}
+
+int main()
+{
+	int n = 6;
+	int k = 7;
+	int s = 0;
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < n; j++) {
+			s = s + (n * k + 1) * (n * k + 1) + i * j;
+		}
+		s = s - k * 2;
+	}
+	printf("s = %d\n", s);
+
+	g = 3;
+	int t = 0;
+	for (int x = 0; x < 5; x++) {
+		t = t + g * 10;
+		bump();
+	}
+	printf("t = %d\n", t);
+	printf("g = %d\n", g);
+
+	int m = 2;
+	int u = 0;
+	for (int y = 0; y < 4; y++) {
+		u = u + m * 100;
+		m = m + y;
+	}
+	printf("u = %d\n", u);
+	printf("m = %d\n", m);
+
+	int a = n * k;
+	int b = n * k;
+	int c = a;
+	c = c * c - a * b;
+	printf("%d %d %d\n", a, b, c);
+
+	int w = 0;
+	while (w < n * k) {
+		w = w + n + k;
+	}
+	printf("w = %d\n", w);
+	return 0;
+}
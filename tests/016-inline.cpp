@@ -0,0 +1,41 @@
+#include <cstdio>
+
+int add(int a, int b)
+{
+	return a + b;
+}
+
+int mul(int a, int b)
+{
+	int r = a * b;
+	return r;
+}
+
+int sq(int x)
+{
+	return mul(x, x);
+}
+
+int fact(int n)
+{
+	if (n < 2) return 1;
+	return n * fact(n - 1);
+}
+
+int seven()
+{
+	return 7;
+}
+
+int main()
+{
+	int a = 1, b = 2, c = 3, d = 4;
+	printf("%d\n", add(add(a, b), mul(c, add(d, 1))));
+	int s = 0;
+	for (int i = 0; i < 10; i++) {
+		s = add(s, sq(i));
+	}
+	printf("%d\n", s);
+	printf("%d %d\n", fact(5), seven() + mul(seven(), 2));
+	return 0;
+}
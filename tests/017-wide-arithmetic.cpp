@@ -0,0 +1,75 @@
+#include <iostream>
+#include <cstdio>
+using namespace std;
+
+double scale;
+
+double area(double r)
+{
+	return 3.14159 * r * r;
+}
+
+long long fact(int n)
+{
+	long long f = 1;
+	for (int i = 2; i <= n; i++) {
+		f = f * i;
+	}
+	return f;
+}
+
+double harmonic(int n)
+{
+	double s = 0;
+	for (int i = 1; i <= n; i++) {
+		s = s + 1.0 / i;
+	}
+	return s;
+}
+
+long long mix(int a, long long b, double c)
+{
+	return a + b + (long long)c;
+}
+
+int main()
+{
+	double x = 2.5;
+	double y = x * 4 + 0.25;
+	cout << "y = " << y << endl;
+	cout << "area = " << area(2.0) << endl;
+
+	long long big = 3000000000;
+	big = big * 3;
+	cout << "big = " << big << endl;
+	cout << "20! = " << fact(20) << endl;
+	printf("H(10) = %.4f, 15! = %lld, %d\n", harmonic(10), fact(15), 7);
+
+	if (x > 2) cout << "x > 2" << endl;
+	if (big == 9000000000) cout << "big == 9000000000" << endl;
+	if (big % 7 != 0) cout << "big % 7 = " << big % 7 << endl;
+
+	long long s = 0;
+	for (long long i = 0; i < 1000; i = i + 1) {
+		s = s + i * i * i;
+	}
+	cout << "sum of cubes = " << s << endl;
+
+	double h = 1;
+	int n = 0;
+	while (h > 0.001) {
+		h = h / 2;
+		n++;
+	}
+	cout << n << " halvings to " << h << endl;
+
+	int k = 35;
+	cout << (int)(x * 10) << " " << (double)k / 4 << endl;
+	float f = 0.5;
+	cout << f + 1 << " " << mix(1, 10000000000, 2.75) << endl;
+
+	scale = 1.5;
+	scale = scale * scale;
+	printf("scale = %g, %e\n", scale, scale * 1000);
+	return 0;
+}
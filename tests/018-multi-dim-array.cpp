@@ -0,0 +1,20 @@
+#include <iostream>
+using namespace std;
+
+int g[2][2][3] = { { { 1, 2, 3 }, { 4, 5, 6 } }, { { 7, 8, 9 }, { 10, 11, 12 } } };
+
+int main()
+{
+	int a[3][4] = { { 1, 2, 3, 4 }, { 5, 6, 7, 8 }, { 9, 10, 11, 12 } };
+	int z[5];
+	double d = 1.5;
+	long long n = 2;
+	int i = 2;
+	int j = 1;
+	cout << a[0][0] << " " << a[1][2] << " " << a[2][3] << " " << a[i][j] << endl;
+	cout << g[1][0][2] << " " << g[0][1][1] << " " << g[j][j][i] << endl;
+	cout << a[i][3] + a[1][j] * 2 << endl;
+	cout << sizeof(a) << " " << sizeof(g) << " " << sizeof(z) << endl;
+	cout << sizeof(i) << " " << sizeof(d) << " " << sizeof(n) << endl;
+	return 0;
+}
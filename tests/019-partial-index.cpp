@@ -0,0 +1,16 @@
+#include <iostream>
+using namespace std;
+
+int g[2][3] = { { 1, 2, 3 }, { 4, 5, 6 } };
+
+int main()
+{
+	int a[3][4] = { { 1, 2, 3, 4 }, { 5, 6, 7, 8 }, { 9, 10, 11, 12 } };
+	int i = 2;
+	int* r = a[1];
+	int* s = a[i];
+	int* t = g[1];
+	cout << r[2] << " " << s[0] << " " << s[3] << " " << t[1] << endl;
+	cout << a[i][1] + r[0] << " " << r[1] * t[2] << endl;
+	return 0;
+}
@@ -0,0 +1,17 @@
+#include <cstdio>
+
+int g[3] = { 4, 5, 6 };
+
+int main()
+{
+	int a[3] = { 1, 2, 3 };
+	int i = 1;
+	int x = 10;
+	int w = x + a[i] + a[i];
+	int y = x * a[i] * a[i];
+	int z = x - a[i] - a[i];
+	printf("%d %d %d\n", w, y, z);
+	int v = x - g[i] * a[i] - g[i] * a[i];
+	printf("%d\n", v);
+	return 0;
+}
@@ -1,12 +1,57 @@
 #!/bin/bash
 set -e
 
+# the first run of each script fills the cache, and later ones load from it
+export ICPP_CACHE_DIR=$(mktemp -d)
+trap "rm -rf $ICPP_CACHE_DIR" EXIT
+
+for opt in "" "-fno-fuse" "-fno-peephole" "-fno-inline" "-O0" "-O2" "-fno-jit" "-O2 -fno-jit" "-r" "-r -fno-fuse" "-r -O2" "-t" "-t -fno-fuse" "-t -O2"; do
+	ls tests/ | grep '\.cpp$' | while read f; do
+		echo "$ ./icpp ${opt:+$opt }tests/$f"
+		./icpp $opt tests/$f | md5sum -c tests/md5sum/${f%.cpp}.md5sum
+	done
+
+	echo "$ ./icpp ${opt:+$opt }tests/007-argc-argv.cpp abc def \"123 xyz\""
+	./icpp $opt tests/007-argc-argv.cpp abc def "123 xyz" | md5sum -c tests/md5sum/007-argc-argv.with-args.md5sum
+done
+
+dir=$(mktemp -d)
+# a damaged cache file is compiled again
+echo "$ ./icpp tests/008-loops.cpp # with a damaged cache file"
+ICPP_CACHE_DIR=$dir ./icpp tests/008-loops.cpp > /dev/null
+f=$(ls $dir/*.icb)
+head -c 200 /dev/zero | tr '\0' '\177' | dd of=$f bs=1 seek=$(($(stat -c %s $f) - 200)) conv=notrunc 2> /dev/null
+ICPP_CACHE_DIR=$dir ./icpp tests/008-loops.cpp | md5sum -c tests/md5sum/008-loops.md5sum
+rm -rf $dir
+
+dir=$(mktemp -d)
 ls tests/ | grep '\.cpp$' | while read f; do
-	echo "$ ./icpp tests/$f"
-	./icpp tests/$f | md5sum -c tests/md5sum/${f%.cpp}.md5sum
+	echo "$ ./icpp --snapshot-at main tests/$f && ./icpp --restore tests/$f.snap"
+	./icpp --snapshot-at main -o $dir/$f.snap tests/$f 2> /dev/null
+	./icpp --restore $dir/$f.snap | md5sum -c tests/md5sum/${f%.cpp}.md5sum
 done
+rm -rf $dir
 
-echo '$ ./icpp tests/007-argc-argv.cpp abc def "123 xyz"'
-./icpp tests/007-argc-argv.cpp abc def "123 xyz" | md5sum -c tests/md5sum/007-argc-argv.with-args.md5sum
+dir=$(mktemp -d)
+# one job divides by zero, which fails that job only
+echo 'int main() { int z = 0; return 1 / z; }' > $dir/div-by-zero.cpp
+ls tests/ | grep '\.cpp$' | sed 's|^|tests/|' > $dir/manifest.txt
+echo "$dir/div-by-zero.cpp" >> $dir/manifest.txt
+echo 'tests/007-argc-argv.cpp abc def "123 xyz"' >> $dir/manifest.txt
+echo "$ ./icpp --batch manifest.txt -j 4 -o out"
+./icpp --batch $dir/manifest.txt -j 4 -o $dir/out > $dir/summary.txt && exit 1
+id=0
+while read f args; do
+	f=$(basename $f .cpp)
+	echo "$ cat out/$id.out"
+	if [ $f = div-by-zero ]; then
+		grep -q "^$id	error	" $dir/summary.txt
+		grep -q "divided by zero" $dir/out/$id.log
+	else
+		md5sum -c tests/md5sum/$f${args:+.with-args}.md5sum < $dir/out/$id.out
+	fi
+	id=$((id+1))
+done < $dir/manifest.txt
+rm -rf $dir
 
 echo "all passed."